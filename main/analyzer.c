@@ -0,0 +1,143 @@
+#include <math.h>
+#include <string.h>
+
+#include "analyzer.h"
+
+#define N ANALYZER_FFT_SIZE
+
+// band levels cover this many octaves of loudness below each band's peak (8.8 fixed point)
+#define LEVEL_RANGE (6 << 8)
+// peaks never decay below this, so silence doesn't turn hiss into full brightness
+#define MIN_PEAK (7 << 8)
+// how long a peak takes to decay by one octave
+#define PEAK_DECAY_MS 4000
+// bass has to jump this far over its running average to be a beat (as a fraction: 3/2)
+#define BEAT_RATIO_NUM 3
+#define BEAT_RATIO_DEN 2
+// and be at least this loud
+#define BEAT_FLOOR 32
+// beats can't come faster than this (240 bpm)
+#define BEAT_GAP_MS 250
+
+// shared by every analyzer, and built on first use
+static int16_t s_window[N];
+static int16_t s_cos[N / 2];
+static int16_t s_sin[N / 2];
+static uint16_t s_reverse[N];
+static bool s_tables_ready = false;
+
+
+static void build_tables(void) {
+    for (int i = 0; i < N; i++) {
+        // hann
+        s_window[i] = (int16_t) (32767 * 0.5 * (1 - cos(2 * M_PI * i / (N - 1))));
+        int r = 0;
+        for (int b = 0; b < ANALYZER_FFT_BITS; b++) if (i & (1 << b)) r |= 1 << (ANALYZER_FFT_BITS - 1 - b);
+        s_reverse[i] = r;
+    }
+    for (int i = 0; i < N / 2; i++) {
+        s_cos[i] = (int16_t) (32767 * cos(2 * M_PI * i / N));
+        s_sin[i] = (int16_t) (32767 * sin(2 * M_PI * i / N));
+    }
+    s_tables_ready = true;
+}
+
+/*
+ * in-place radix-2 FFT on Q15 data that's already in bit-reversed order.
+ * every stage halves its output so nothing can overflow, which makes the
+ * result 1/N of the true transform.
+ */
+static void fft(int16_t *re, int16_t *im) {
+    for (int size = 2, step = N / 2; size <= N; size <<= 1, step >>= 1) {
+        int half = size >> 1;
+        for (int k = 0; k < half; k++) {
+            int32_t wr = s_cos[k * step];
+            int32_t wi = -s_sin[k * step];
+            for (int j = k; j < N; j += size) {
+                int l = j + half;
+                int32_t tr = (wr * re[l] - wi * im[l]) >> 15;
+                int32_t ti = (wr * im[l] + wi * re[l]) >> 15;
+                int32_t ur = re[j], ui = im[j];
+                re[l] = (ur - tr) >> 1;
+                im[l] = (ui - ti) >> 1;
+                re[j] = (ur + tr) >> 1;
+                im[j] = (ui + ti) >> 1;
+            }
+        }
+    }
+}
+
+// |re + i im|, approximated as max + 3/8 min (within about 7%)
+static inline uint32_t magnitude(int32_t re, int32_t im) {
+    uint32_t a = re < 0 ? -re : re;
+    uint32_t b = im < 0 ? -im : im;
+    return a > b ? a + ((3 * b) >> 3) : b + ((3 * a) >> 3);
+}
+
+// log2(x) in 8.8 fixed point, with the fraction linearly interpolated
+static int32_t log2_fixed(uint32_t x) {
+    if (x == 0) return 0;
+    int n = 31 - __builtin_clz(x);
+    uint32_t fraction = n >= 8 ? (x >> (n - 8)) & 0xff : (x << (8 - n)) & 0xff;
+    return (n << 8) | fraction;
+}
+
+
+// ----- API
+
+void analyzer_init(analyzer_t *analyzer, int block_rate) {
+    if (!s_tables_ready) build_tables();
+    memset(analyzer, 0, sizeof(*analyzer));
+    for (int b = 0; b < ANALYZER_BANDS; b++) analyzer->peak[b] = MIN_PEAK;
+    analyzer->beat_gap_blocks = block_rate * BEAT_GAP_MS / 1000;
+    analyzer->peak_decay = (256 * 1000) / (PEAK_DECAY_MS * block_rate);
+    if (analyzer->peak_decay < 1) analyzer->peak_decay = 1;
+    analyzer->blocks_since_beat = analyzer->beat_gap_blocks;
+}
+
+void analyzer_run(analyzer_t *analyzer, const int16_t *samples) {
+    int16_t *re = analyzer->re, *im = analyzer->im;
+    for (int i = 0; i < N; i++) {
+        re[s_reverse[i]] = (samples[i] * s_window[i]) >> 15;
+        im[i] = 0;
+    }
+    fft(re, im);
+
+    analyzer_result_t *result = &analyzer->result;
+    uint32_t bass = 0;
+    result->level = 0;
+    for (int b = 0; b < ANALYZER_BANDS; b++) {
+        // band b is bins [2^b, 2^(b+1)): one octave each, from just above DC to nyquist
+        int first = 1 << b, last = 2 << b;
+        uint32_t sum = 0;
+        for (int bin = first; bin < last; bin++) sum += magnitude(re[bin], im[bin]);
+        uint32_t average = sum >> b;
+        if (b < 2) bass += average;
+
+        int32_t log = log2_fixed(average);
+        int32_t *peak = &analyzer->peak[b];
+        if (log > *peak) {
+            *peak = log;
+        } else if (*peak > MIN_PEAK) {
+            *peak -= analyzer->peak_decay;
+        }
+        int32_t level = ((log - (*peak - LEVEL_RANGE)) * 255) / LEVEL_RANGE;
+        result->bands[b] = level < 0 ? 0 : level > 255 ? 255 : level;
+        if (result->bands[b] > result->level) result->level = result->bands[b];
+    }
+
+    // a beat is a jump in bass over its average of the last half second or so
+    result->beat = false;
+    analyzer->blocks_since_beat++;
+    if (
+        analyzer->blocks_since_beat >= analyzer->beat_gap_blocks &&
+        bass > BEAT_FLOOR &&
+        bass * BEAT_RATIO_DEN > analyzer->bass_average * BEAT_RATIO_NUM
+    ) {
+        result->beat = true;
+        result->beat_count++;
+        analyzer->blocks_since_beat = 0;
+    }
+    int smoothing = analyzer->beat_gap_blocks * 2 + 1;
+    analyzer->bass_average += ((int32_t) bass - (int32_t) analyzer->bass_average) / smoothing;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * turns blocks of audio into what the lights need: a level for each of a
+ * few log-spaced frequency bands, and beats. it's all integer math (a Q15
+ * fixed-point FFT), and it doesn't depend on anything ESP-specific, so
+ * tools/audio_bench.c can run the same code on a host.
+ *
+ * each call analyzes the latest ANALYZER_FFT_SIZE samples, so calling it
+ * every half block (for 50% overlap) is fine.
+ */
+
+// must be a power of 2
+#ifndef ANALYZER_FFT_BITS
+#define ANALYZER_FFT_BITS 9
+#endif
+#define ANALYZER_FFT_SIZE (1 << ANALYZER_FFT_BITS)
+
+// octaves, from the bin above DC up to nyquist
+#define ANALYZER_BANDS (ANALYZER_FFT_BITS - 1)
+
+typedef struct {
+    // 0 - 255, relative to the loudest each band has been lately
+    uint8_t bands[ANALYZER_BANDS];
+    // loudest band
+    uint8_t level;
+    // true if this block started a beat
+    bool beat;
+    // total beats so far
+    uint32_t beat_count;
+} analyzer_result_t;
+
+typedef struct {
+    int16_t re[ANALYZER_FFT_SIZE];
+    int16_t im[ANALYZER_FFT_SIZE];
+    // log2 of the loudest each band has been (8.8 fixed point), decaying
+    int32_t peak[ANALYZER_BANDS];
+    // running average of bass energy, for spotting beats
+    uint32_t bass_average;
+    int blocks_since_beat;
+    int beat_gap_blocks;
+    int peak_decay;
+    analyzer_result_t result;
+} analyzer_t;
+
+// `block_rate` is how many times a second `analyzer_run` will be called, for time constants.
+void analyzer_init(analyzer_t *analyzer, int block_rate);
+
+// analyze ANALYZER_FFT_SIZE samples (oldest first), updating `analyzer->result`.
+void analyzer_run(analyzer_t *analyzer, const int16_t *samples);
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "anim.h"
+#include "cli.h"
+#include "render.h"
+
+// erases have to cover whole flash sectors
+#define SECTOR_SIZE 4096
+
+static const esp_partition_t *s_partition = NULL;
+static SemaphoreHandle_t s_lock;
+
+// everything below is protected by `s_lock`
+static spi_flash_mmap_handle_t s_mmap;
+// NULL if there's nothing valid to play
+static const anim_header_t *s_header = NULL;
+static const uint32_t *s_index;
+static const uint8_t *s_data;
+
+// the most recently decoded frame, so deltas can apply on top of it
+static uint8_t s_frame[RENDER_MAX_PIXELS * 3];
+static int s_current = -1;
+
+// upload in progress
+static size_t s_upload_size = 0;
+static size_t s_upload_offset = 0;
+// the partition is erased up to here
+static size_t s_upload_erased = 0;
+
+
+// apply one frame's ops to `frame`. returns false if the data is corrupt.
+static bool apply(const uint8_t *p, const uint8_t *end, uint8_t *frame, int size) {
+    int i = 0;
+    while (i < size) {
+        if (p >= end) return false;
+        uint8_t op = *p++;
+        int n = (op & 0x7f) + 1;
+        if (i + n > size) return false;
+        if (op & 0x80) {
+            if (p + n > end) return false;
+            for (int k = 0; k < n; k++) frame[i + k] ^= p[k];
+            p += n;
+        }
+        i += n;
+    }
+    return true;
+}
+
+static const uint8_t *frame_end(int index) {
+    return s_data + (index + 1 < s_header->frame_count ? s_index[index + 1] : s_header->size);
+}
+
+// decode frame `index` into `s_frame`, starting from the nearest keyframe or the current frame.
+static bool seek(int index) {
+    int start = index;
+    while (start > 0 && s_data[s_index[start]] != ANIM_KEYFRAME) start--;
+    if (s_current >= start && s_current <= index) start = s_current + 1;
+
+    int size = s_header->pixel_count * 3;
+    for (int i = start; i <= index; i++) {
+        const uint8_t *p = s_data + s_index[i];
+        if (*p == ANIM_KEYFRAME) memset(s_frame, 0, size);
+        if (!apply(p + 1, frame_end(i), s_frame, size)) {
+            s_current = -1;
+            return false;
+        }
+        s_current = i;
+    }
+    return true;
+}
+
+// check the header and index, so playback only has to bounds-check the frames.
+static bool validate(const anim_header_t *header, size_t size) {
+    if (size < sizeof(anim_header_t) || header->magic != ANIM_MAGIC || header->version != ANIM_VERSION) return false;
+    if (header->size > size || header->pixel_count == 0 || header->pixel_count > RENDER_MAX_PIXELS) return false;
+    if (header->frame_count == 0 || header->frame_count > size / sizeof(uint32_t) || header->frame_ms == 0) return false;
+    size_t frames_start = sizeof(anim_header_t) + header->frame_count * sizeof(uint32_t);
+    if (frames_start >= header->size) return false;
+
+    const uint8_t *data = (const uint8_t *) header;
+    const uint32_t *index = (const uint32_t *) (data + sizeof(anim_header_t));
+    for (int i = 0; i < header->frame_count; i++) {
+        if (index[i] < frames_start || index[i] >= header->size) return false;
+        if (i > 0 && index[i] <= index[i - 1]) return false;
+    }
+    return data[index[0]] == ANIM_KEYFRAME;
+}
+
+// map the partition and start playing whatever's in it. (`s_lock` must be held.)
+static void map(void) {
+    const void *ptr;
+    if (esp_partition_mmap(s_partition, 0, s_partition->size, SPI_FLASH_MMAP_DATA, &ptr, &s_mmap) != ESP_OK) return;
+    if (!validate(ptr, s_partition->size)) {
+        spi_flash_munmap(s_mmap);
+        return;
+    }
+    s_header = ptr;
+    s_index = (const uint32_t *) ((const uint8_t *) ptr + sizeof(anim_header_t));
+    s_data = ptr;
+    s_current = -1;
+}
+
+static void unmap(void) {
+    if (s_header == NULL) return;
+    s_header = NULL;
+    spi_flash_munmap(s_mmap);
+}
+
+
+// ----- API
+
+void anim_render(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_header == NULL || !seek((t / s_header->frame_ms) % s_header->frame_count)) {
+        memset(pixels, 0, count * 3);
+    } else {
+        int n = s_header->pixel_count < count ? s_header->pixel_count : count;
+        memcpy(pixels, s_frame, n * 3);
+        memset(pixels + n * 3, 0, (count - n) * 3);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+bool anim_upload_begin(size_t size) {
+    if (s_partition == NULL || size > s_partition->size) return false;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    unmap();
+    xSemaphoreGive(s_lock);
+
+    s_upload_size = size;
+    s_upload_offset = 0;
+    s_upload_erased = 0;
+    // only the first sector for now, so the old header is gone even if the upload dies; the
+    // rest gets erased as the writes reach it, rather than stalling the request for seconds here.
+    if (esp_partition_erase_range(s_partition, 0, SECTOR_SIZE) != ESP_OK) return false;
+    s_upload_erased = SECTOR_SIZE;
+    return true;
+}
+
+bool anim_upload_write(const void *data, size_t len) {
+    if (s_upload_offset + len > s_upload_size) return false;
+    while (s_upload_erased < s_upload_offset + len) {
+        if (esp_partition_erase_range(s_partition, s_upload_erased, SECTOR_SIZE) != ESP_OK) return false;
+        s_upload_erased += SECTOR_SIZE;
+    }
+    if (esp_partition_write(s_partition, s_upload_offset, data, len) != ESP_OK) return false;
+    s_upload_offset += len;
+    return true;
+}
+
+bool anim_upload_end(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    map();
+    bool ok = (s_header != NULL);
+    xSemaphoreGive(s_lock);
+    return ok;
+}
+
+
+// ----- CLI
+
+static void cmd_anim_info(const void *command_arg, int argc, const char * const *argv) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_header == NULL) {
+        printf("no animation\n");
+    } else {
+        int keyframes = 0;
+        for (int i = 0; i < s_header->frame_count; i++) if (s_data[s_index[i]] == ANIM_KEYFRAME) keyframes++;
+        printf("%u frames (%d keyframes) of %d pixels, %d ms/frame, %u bytes (%u%% of raw)\n",
+            s_header->frame_count, keyframes, s_header->pixel_count, s_header->frame_ms, s_header->size,
+            (uint32_t) ((uint64_t) s_header->size * 100 / ((uint64_t) s_header->frame_count * s_header->pixel_count * 3)));
+    }
+    xSemaphoreGive(s_lock);
+}
+
+// decode every frame in order (the playback case), then seek to random frames (the worst case).
+static void cmd_anim_bench(const void *command_arg, int argc, const char * const *argv) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_header == NULL) {
+        xSemaphoreGive(s_lock);
+        printf("no animation\n");
+        return;
+    }
+    int frames = s_header->frame_count;
+    s_current = -1;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < frames; i++) seek(i);
+    int64_t sequential = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    uint32_t x = 1;
+    for (int i = 0; i < frames; i++) {
+        x = x * 1103515245 + 12345;
+        seek((x >> 8) % frames);
+    }
+    int64_t random = esp_timer_get_time() - start;
+    s_current = -1;
+    xSemaphoreGive(s_lock);
+
+    printf("sequential: %lld ns/frame\n", sequential * 1000 / frames);
+    printf("random:     %lld ns/frame\n", random * 1000 / frames);
+}
+
+static cli_command_t anim_commands[] = {
+    { "info", "show the stored animation", cmd_anim_info, NULL, NULL },
+    { "bench", "time frame decoding", cmd_anim_bench, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "anim", NULL, NULL, NULL, anim_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void anim_init(void) {
+    s_lock = xSemaphoreCreateMutex();
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ANIM_PARTITION_SUBTYPE, "anim");
+    if (s_partition != NULL) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        map();
+        xSemaphoreGive(s_lock);
+    }
+    printf("anim_init: %s\n", s_partition == NULL ? "no partition" : s_header == NULL ? "empty" : "ready");
+    cli_register_commands(commands);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * prerecorded animations live in the "anim" data partition, and play back
+ * straight out of memory-mapped flash: only the current frame is ever in
+ * RAM. the format (all little-endian) is:
+ *
+ *     anim_header_t
+ *     u32 offset of each frame, from the start of the header
+ *     frames
+ *
+ * each frame is a type byte (ANIM_KEYFRAME or ANIM_DELTA) followed by ops
+ * that XOR into the frame's RGB bytes, covering exactly pixel_count * 3
+ * bytes. a keyframe XORs into a black frame; a delta XORs into the frame
+ * before it. each op is one byte:
+ *
+ *     0nnnnnnn: skip n + 1 bytes (unchanged)
+ *     1nnnnnnn: XOR the next n + 1 bytes in
+ *
+ * frame 0 must be a keyframe. tools/anim_encode.py builds these.
+ */
+
+#define ANIM_MAGIC 0x4e414247  // "GBAN"
+#define ANIM_VERSION 1
+#define ANIM_KEYFRAME 0
+#define ANIM_DELTA 1
+
+// the partition table's subtype for the "anim" partition
+#define ANIM_PARTITION_SUBTYPE 0x40
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t pixel_count;
+    uint32_t frame_count;
+    uint16_t frame_ms;
+    uint16_t reserved2;
+    // total bytes, including this header
+    uint32_t size;
+} anim_header_t;
+
+// map the partition (if it has a valid animation), and register CLI commands.
+void anim_init(void);
+
+/*
+ * effect callback: fill `pixels` with the frame for time `t`. the animation
+ * loops, and if it's shorter than `count`, the rest is black.
+ */
+void anim_render(uint32_t color, uint32_t t, uint8_t *pixels, int count);
+
+/*
+ * replace the animation: `begin` stops playback, `write` appends data in
+ * order (erasing each flash sector as it gets there), and `end` checks the
+ * result and starts playing it. returns false on failure (after which nothing plays
+ * until a good upload).
+ */
+bool anim_upload_begin(size_t size);
+bool anim_upload_write(const void *data, size_t len);
+bool anim_upload_end(void);
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver/i2s.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "audio.h"
+#include "cli.h"
+#include "effect.h"
+#include "perf.h"
+#include "settings.h"
+
+#define N ANALYZER_FFT_SIZE
+
+// how long a beat flash takes to fade
+#define BEAT_FLASH_MS 200
+
+static TaskHandle_t s_task = NULL;
+static volatile bool s_enabled = false;
+
+// only touched by the audio task
+static int32_t s_raw[AUDIO_HOP];
+static int16_t s_ring[N];
+static int16_t s_block[N];
+static analyzer_t s_analyzer;
+
+/*
+ * the latest result. the audio task bumps `s_sequence` to odd before
+ * writing and back to even after, so a reader can tell if its copy is torn.
+ * the audio task runs at a higher priority than the render task, so on one
+ * core a reader never sees it mid-write, and on two it just copies again.
+ */
+static volatile uint32_t s_sequence = 0;
+static struct {
+    uint8_t bands[ANALYZER_BANDS];
+    uint8_t level;
+    uint32_t beat_count;
+    uint32_t beat_time;
+} s_shared;
+
+
+static void publish(const analyzer_result_t *result) {
+    uint32_t sequence = s_sequence;
+    __atomic_store_n(&s_sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (result == NULL) {
+        memset(s_shared.bands, 0, sizeof(s_shared.bands));
+        s_shared.level = 0;
+    } else {
+        memcpy(s_shared.bands, result->bands, sizeof(s_shared.bands));
+        s_shared.level = result->level;
+        if (result->beat) s_shared.beat_time = esp_timer_get_time() / 1000;
+        s_shared.beat_count = result->beat_count;
+    }
+    __atomic_store_n(&s_sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void audio_task(void *arg) {
+    int position = 0, pending = 0;
+    analyzer_init(&s_analyzer, AUDIO_SAMPLE_RATE / AUDIO_HOP);
+
+    while (true) {
+        if (!s_enabled) {
+            publish(NULL);
+            i2s_stop(I2S_NUM_0);
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            i2s_start(I2S_NUM_0);
+            continue;
+        }
+
+        size_t bytes = 0;
+        i2s_read(I2S_NUM_0, s_raw, sizeof(s_raw), &bytes, portMAX_DELAY);
+        int count = bytes / sizeof(int32_t);
+        for (int i = 0; i < count; i++) {
+            int32_t sample = s_raw[i] >> AUDIO_SAMPLE_SHIFT;
+            s_ring[position] = sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+            position = (position + 1) & (N - 1);
+        }
+        pending += count;
+        if (pending < AUDIO_HOP) continue;
+        pending = 0;
+
+        // unroll the ring, oldest sample first
+        memcpy(s_block, s_ring + position, (N - position) * sizeof(int16_t));
+        memcpy(s_block + N - position, s_ring, position * sizeof(int16_t));
+        int64_t start = perf_now();
+        analyzer_run(&s_analyzer, s_block);
+        perf_timer_record(PERF_TIMER_AUDIO, start);
+        publish(&s_analyzer.result);
+    }
+}
+
+static void start(void) {
+    i2s_config_t config = {
+        .mode = I2S_MODE_MASTER | I2S_MODE_RX,
+        .sample_rate = AUDIO_SAMPLE_RATE,
+        .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
+        .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+        .intr_alloc_flags = 0,
+        .dma_buf_count = 4,
+        .dma_buf_len = AUDIO_HOP,
+    };
+    i2s_pin_config_t pins = {
+        .bck_io_num = AUDIO_BCK_GPIO,
+        .ws_io_num = AUDIO_WS_GPIO,
+        .data_out_num = I2S_PIN_NO_CHANGE,
+        .data_in_num = AUDIO_DATA_GPIO,
+    };
+    if (i2s_driver_install(I2S_NUM_0, &config, 0, NULL) != ESP_OK || i2s_set_pin(I2S_NUM_0, &pins) != ESP_OK) {
+        printf("audio: can't start i2s\n");
+        return;
+    }
+    // above the render task; see `s_sequence`
+    xTaskCreate(audio_task, "audio", AUDIO_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 6, &s_task);
+}
+
+static void setting_changed(setting_t setting) {
+    s_enabled = settings_get_int(SETTING_AUDIO);
+    if (s_task == NULL) {
+        if (s_enabled) start();
+    } else {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+
+// ----- API
+
+void audio_get(audio_levels_t *levels) {
+    uint32_t sequence, beat_time;
+    do {
+        sequence = __atomic_load_n(&s_sequence, __ATOMIC_ACQUIRE);
+        memcpy(levels->bands, s_shared.bands, sizeof(levels->bands));
+        levels->level = s_shared.level;
+        levels->beat_count = s_shared.beat_count;
+        beat_time = s_shared.beat_time;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) || sequence != __atomic_load_n(&s_sequence, __ATOMIC_RELAXED));
+
+    levels->since_beat = levels->beat_count == 0 ? UINT32_MAX : (uint32_t) (esp_timer_get_time() / 1000) - beat_time;
+}
+
+static inline void put_pixel(uint8_t *pixels, int i, uint32_t rgb) {
+    pixels[i * 3] = (rgb >> 16) & 0xff;
+    pixels[i * 3 + 1] = (rgb >> 8) & 0xff;
+    pixels[i * 3 + 2] = rgb & 0xff;
+}
+
+// bass at the start of the run, treble at the end. beats wash it toward white.
+void audio_render(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    audio_levels_t levels;
+    audio_get(&levels);
+    int flash = levels.since_beat < BEAT_FLASH_MS ? 255 - (levels.since_beat * 255) / BEAT_FLASH_MS : 0;
+    for (int i = 0; i < count; i++) {
+        int band = (i * ANALYZER_BANDS) / count;
+        put_pixel(pixels, i, effect_hsv(band * (256 / ANALYZER_BANDS), 255 - (flash >> 1), levels.bands[band]));
+    }
+}
+
+
+// ----- CLI
+
+static void cmd_audio_show(const void *command_arg, int argc, const char * const *argv) {
+    audio_levels_t levels;
+    audio_get(&levels);
+    if (!s_enabled) printf("(audio is off: config set audio on)\n");
+    for (int b = 0; b < ANALYZER_BANDS; b++) {
+        int hz = (AUDIO_SAMPLE_RATE << b) / N;
+        printf("%6d Hz %3d ", hz, levels.bands[b]);
+        for (int i = 0; i < levels.bands[b] / 8; i++) printf("#");
+        printf("\n");
+    }
+    printf("%u beats\n", levels.beat_count);
+}
+
+#define BENCH_BLOCKS 200
+
+// analyze a synthetic signal (a tone over noise, with a kick every half second)
+static void cmd_audio_bench(const void *command_arg, int argc, const char * const *argv) {
+    analyzer_t *analyzer = malloc(sizeof(analyzer_t));
+    int16_t *block = malloc(N * sizeof(int16_t));
+    if (analyzer == NULL || block == NULL) {
+        printf("out of memory\n");
+        free(analyzer);
+        free(block);
+        return;
+    }
+    int block_rate = AUDIO_SAMPLE_RATE / AUDIO_HOP;
+    analyzer_init(analyzer, block_rate);
+
+    uint32_t noise = 1;
+    int64_t total = 0, worst = 0;
+    for (int b = 0; b < BENCH_BLOCKS; b++) {
+        bool kick = (b % (block_rate / 2)) < 4;
+        for (int i = 0; i < N; i++) {
+            noise = noise * 1103515245 + 12345;
+            int tone = effect_sin8((b * N + i) * 10) - 128;
+            block[i] = tone * 64 + (int) ((noise >> 16) & 0x3ff) - 512 + (kick ? (effect_sin8(i) - 128) * 128 : 0);
+        }
+        int64_t start = esp_timer_get_time();
+        analyzer_run(analyzer, block);
+        int64_t elapsed = esp_timer_get_time() - start;
+        total += elapsed;
+        if (elapsed > worst) worst = elapsed;
+    }
+    int64_t hop_us = (int64_t) AUDIO_HOP * 1000000 / AUDIO_SAMPLE_RATE;
+    printf("%d-point fft + analysis: %lld us average, %lld us worst\n", N, total / BENCH_BLOCKS, worst);
+    printf("one block every %lld us at %d Hz: %lld%% of the cpu\n", hop_us, AUDIO_SAMPLE_RATE, total * 100 / BENCH_BLOCKS / hop_us);
+    printf("%u beats detected\n", analyzer->result.beat_count);
+    free(analyzer);
+    free(block);
+}
+
+static cli_command_t audio_commands[] = {
+    { "show", "show band levels", cmd_audio_show, NULL, NULL },
+    { "bench", "time the analysis", cmd_audio_bench, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "audio", NULL, NULL, NULL, audio_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void audio_init(void) {
+    settings_watch(SETTING_AUDIO, setting_changed);
+    setting_changed(SETTING_AUDIO);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "analyzer.h"
+
+/*
+ * reads an I2S microphone (like an INMP441) in its own task, and analyzes
+ * it every AUDIO_HOP samples. the render task picks up the latest result
+ * with `audio_get`, which never blocks: the audio task publishes through
+ * a sequence counter, and a reader that catches it mid-update just copies
+ * again. the "audio" setting turns it on.
+ */
+
+#ifndef AUDIO_SAMPLE_RATE
+#define AUDIO_SAMPLE_RATE 44100
+#endif
+
+// samples between analyses: half the FFT, so blocks overlap by 50%
+#define AUDIO_HOP (ANALYZER_FFT_SIZE / 2)
+
+#ifndef AUDIO_BCK_GPIO
+#define AUDIO_BCK_GPIO 26
+#endif
+#ifndef AUDIO_WS_GPIO
+#define AUDIO_WS_GPIO 25
+#endif
+#ifndef AUDIO_DATA_GPIO
+#define AUDIO_DATA_GPIO 33
+#endif
+
+// the mic sends 24 bits left-justified in 32; shifting right by less than 16 adds gain
+#ifndef AUDIO_SAMPLE_SHIFT
+#define AUDIO_SAMPLE_SHIFT 14
+#endif
+
+#ifndef AUDIO_TASK_STACK_SIZE
+#define AUDIO_TASK_STACK_SIZE 3072
+#endif
+
+typedef struct {
+    uint8_t bands[ANALYZER_BANDS];
+    uint8_t level;
+    uint32_t beat_count;
+    // msec since the last beat (saturates)
+    uint32_t since_beat;
+} audio_levels_t;
+
+// register CLI commands, and start listening if the "audio" setting is on.
+void audio_init(void);
+
+// copy out the latest levels. all zero if audio is off.
+void audio_get(audio_levels_t *levels);
+
+// effect callback: a spectrum across the pixels, flashing on beats.
+void audio_render(uint32_t color, uint32_t t, uint8_t *pixels, int count);
@@ -1,7 +1,14 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "driver/uart.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
 
 #include "cli.h"
+#include "pool.h"
+#include "trace.h"
 
 #if CLI_USE_COLORS
 #define ANSI_COLOR_RED "\x1b[31m"
@@ -23,156 +30,238 @@
 
 #define ANSI_CLEAR_LINE "\x1b[128D\x1b[K"
 
-#define outstr(_s) uart_write_bytes(s_cli_uart, _s, sizeof(_s))
-#define display_prompt() outstr(ANSI_BOLD CLI_PROMPT ANSI_BOLD_OFF)
-#define clear_line() outstr(ANSI_CLEAR_LINE)
+#define TELNET_SE 240
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+#define TELNET_ECHO 1
+#define TELNET_SGA 3
 
-static uart_port_t s_cli_uart;
+#define outstr(_session, _s) out(_session, _s, sizeof(_s) - 1)
+#define display_prompt(_session) outstr(_session, ANSI_BOLD CLI_PROMPT ANSI_BOLD_OFF)
+#define clear_line(_session) outstr(_session, ANSI_CLEAR_LINE)
+
+typedef struct cli_session cli_session_t;
+typedef void (*cli_write_t)(cli_session_t *session, const uint8_t *data, size_t len);
 
-const cli_command_t *s_command_sets[CLI_MAX_COMMAND_SETS] = { NULL, };
-int s_command_sets_count = 0;
+/*
+ * everything a single line editor needs: the UART console is one session,
+ * and each TCP connection gets its own. they all share the command index.
+ */
+struct cli_session {
+    // where output goes (NULL until the session is started)
+    cli_write_t write;
+    // the TCP connection, or -1
+    int socket;
+    TaskHandle_t task;
 
-// current edit buffer
-static uint8_t s_buffer[CLI_BUFFER_SIZE];
-static uint8_t s_buffer_length = 0;
-static uint8_t s_cursor = 0;
+    // output is assembled here, so each keypress or redraw turns into one write
+    uint8_t out[CLI_OUTPUT_BUFFER_SIZE];
+    size_t out_length;
+
+    // current edit buffer
+    uint8_t buffer[CLI_BUFFER_SIZE];
+    uint8_t buffer_length;
+    uint8_t cursor;
+
+    // history
+    uint8_t history[CLI_HISTORY_BUFFER_SIZE];
+    uint8_t history_index;
+    uint8_t history_length;
+    bool history_active;
+
+    // for scripts: where output goes
+    cli_output_t output;
+    void *output_context;
+    // ...and where it waits until the line is done (a pool block, or NULL to send it right away)
+    uint8_t *held;
+    size_t held_length;
+
+    // key (input) state
+    uint8_t csi_state;  // 1=\e, 2=\e[ (CSI)
+    uint8_t csi_param;  // digits following CSI
+    uint8_t telnet_state;  // 1=IAC, 2=IAC+option verb, 3=subnegotiation, 4=IAC in subnegotiation
+    uint8_t last_key;
+};
 
-// history
-static uint8_t s_history[CLI_HISTORY_BUFFER_SIZE];
-static uint8_t s_history_index = 0;
-static uint8_t s_history_length = 0;
-static bool s_history_active = false;
+static uart_port_t s_cli_uart;
+static cli_session_t s_uart_session;
+static cli_session_t s_tcp_sessions[CLI_MAX_TCP_SESSIONS];
+
+// command callbacks weren't written to be reentrant, so only one session runs a command at a time.
+// (it's recursive because a command can run a script.)
+static SemaphoreHandle_t s_command_lock = NULL;
+// reserved so running a script doesn't hit the heap, and the task running each one (or NULL if it's free)
+static cli_session_t s_script_sessions[CLI_MAX_SCRIPTS];
+static TaskHandle_t s_script_tasks[CLI_MAX_SCRIPTS];
+static portMUX_TYPE s_script_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * registered commands are compiled into a sorted index: the top-level
+ * commands live in `s_root`, and each command's subcommands are a sorted,
+ * contiguous run in `s_subcommands`. since it's sorted by command word, all
+ * the commands that start with some prefix are next to each other, so
+ * matching a word is a binary search.
+ */
+typedef struct {
+    const cli_command_t *command;
+    // length of the command word (up to the first space)
+    uint8_t word_len;
+    uint8_t subcommand_count;
+    uint16_t subcommand_start;
+} cli_index_t;
+
+static cli_index_t s_root[CLI_MAX_COMMANDS];
+static int s_root_count = 0;
+static cli_index_t s_subcommands[CLI_MAX_SUBCOMMANDS];
+static int s_subcommands_count = 0;
+// commands can be registered from other tasks while the CLI is running
+static SemaphoreHandle_t s_index_lock = NULL;
+
+
+// ----- output
+
+static void flush(cli_session_t *session) {
+    if (session->out_length == 0 || session->write == NULL) return;
+    session->write(session, session->out, session->out_length);
+    session->out_length = 0;
+}
 
-// key (input) state
-static uint8_t s_csi_state = 0;  // 1=\e, 2=\e[ (CSI)
-static uint8_t s_csi_param = 0;  // digits following CSI
+static void out(cli_session_t *session, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        if (session->out_length == sizeof(session->out)) {
+            flush(session);
+            // not started yet? drop the overflow.
+            if (session->out_length == sizeof(session->out)) return;
+        }
+        size_t n = sizeof(session->out) - session->out_length;
+        if (n > len) n = len;
+        memcpy(session->out + session->out_length, p, n);
+        session->out_length += n;
+        p += n, len -= n;
+    }
+}
 
 
-#define move_left(_n) csi_move(_n, 'D')
-#define move_right(_n) csi_move(_n, 'C')
+#define move_left(_session, _n) csi_move(_session, _n, 'D')
+#define move_right(_session, _n) csi_move(_session, _n, 'C')
 
-static void csi_move(int n, uint8_t command) {
+static void csi_move(cli_session_t *session, int n, uint8_t command) {
     if (n == 0) return;
     char s[8];
     int len = snprintf(s, 8, "\x1b[%d%c", n, command);
-    uart_write_bytes(s_cli_uart, s, len);
+    out(session, s, len);
 }
 
 
 // ----- display help
 
 static const char SPACES[33] = "                                ";
-static void display_spaces(int count) {
+static void display_spaces(cli_session_t *session, int count) {
     if (count <= 0) return;
     while (count > 32) {
-        outstr(SPACES);
+        outstr(session, SPACES);
         count -= 32;
     }
-    uart_write_bytes(s_cli_uart, SPACES, count);
-}
-
-// collect pointers to commands into a single array. returns how many slots were used.
-static int collect_commands(const cli_command_t * const *command_sets, int command_sets_count, const cli_command_t **target, int slots) {
-    int n = 0;
-    for (int ci = 0; ci < command_sets_count; ci++) {
-        const cli_command_t *commands = command_sets[ci];
-        for (int c = 0; commands[c].name != NULL; c++) {
-            target[n++] = &commands[c];
-            if (n == slots) return n;
-        }
-    }
-    return n;
+    out(session, SPACES, count);
 }
 
-// simple selection sort
-static void sort_commands(const cli_command_t **commands, int command_count) {
-    for (int i = 0; i < command_count; i++) {
-        int target = i;
-        for (int j = i + 1; j < command_count; j++) {
-            if (strcmp(commands[j]->name, commands[target]->name) < 0) target = j;
-        }
-        if (target != i) {
-            const cli_command_t *temp = commands[i];
-            commands[i] = commands[target];
-            commands[target] = temp;
-        }
-    }
-}
-
-static void display_help_span(const cli_command_t **commands, int command_count, int slots_remaining, int indent) {
-    sort_commands(commands, command_count);
-
-    for (int c = 0; c < command_count; c++) {
-        display_spaces(indent);
-        uart_write_bytes(s_cli_uart, commands[c]->name, strlen(commands[c]->name));
-        int filled = indent + strlen(commands[c]->name);
+static void display_help_span(cli_session_t *session, const cli_index_t *entries, int count, int indent) {
+    for (int c = 0; c < count; c++) {
+        const cli_command_t *command = entries[c].command;
+        display_spaces(session, indent);
+        out(session, command->name, strlen(command->name));
+        int filled = indent + strlen(command->name);
         bool displayed_subcommands = false;
 
         // if all subcommands are help-free, just dump them in one line
-        if (commands[c]->subcommands) {
-            const cli_command_t *sub = commands[c]->subcommands;
+        if (command->subcommands) {
+            const cli_command_t *sub = command->subcommands;
             bool all_empty = true;
             for (int sc = 0; sub[sc].name != NULL; sc++) if (sub[sc].help) all_empty = false;
             if (all_empty) {
-                outstr(" <");
+                outstr(session, " <");
                 for (int sc = 0; sub[sc].name != NULL; sc++) {
-                    if (sc != 0) outstr(" | ");
-                    uart_write_bytes(s_cli_uart, sub[sc].name, strlen(sub[sc].name));
+                    if (sc != 0) outstr(session, " | ");
+                    out(session, sub[sc].name, strlen(sub[sc].name));
                     filled += (sc != 0 ? 3 : 0) + strlen(sub[sc].name);
                 }
-                outstr(">");
+                outstr(session, ">");
                 filled += 3;
                 displayed_subcommands = true;
             }
         }
 
-        if (commands[c]->help != NULL) {
+        if (command->help != NULL) {
             if (filled >= CLI_HELP_LEFT_PAD) {
-                outstr("\r\n");
+                outstr(session, "\r\n");
                 filled = 0;
             }
-            display_spaces(CLI_HELP_LEFT_PAD - filled);
-            uart_write_bytes(s_cli_uart, commands[c]->help, strlen(commands[c]->help));
+            display_spaces(session, CLI_HELP_LEFT_PAD - filled);
+            out(session, command->help, strlen(command->help));
         }
-        outstr("\r\n");
-        if (commands[c]->subcommands && !displayed_subcommands) {
-            const cli_command_t **new_commands = &commands[command_count];
-            int new_count = collect_commands(&commands[c]->subcommands, 1, new_commands, slots_remaining);
-            display_help_span(new_commands, new_count, slots_remaining - new_count, indent + 4);
+        outstr(session, "\r\n");
+        if (command->subcommands && !displayed_subcommands) {
+            display_help_span(session, &s_subcommands[entries[c].subcommand_start], entries[c].subcommand_count, indent + 4);
         }
     }
 }
 
-static void display_help(void) {
-    const cli_command_t *commands[CLI_MAX_COLLECT];
-    int command_count = collect_commands(s_command_sets, s_command_sets_count, commands, CLI_MAX_COLLECT);
-
-    outstr(ANSI_UNDERLINE "Commands:" ANSI_UNDERLINE_OFF "\r\n");
-    display_help_span(commands, command_count, CLI_MAX_COLLECT - command_count, 0);
+static void display_help(cli_session_t *session) {
+    outstr(session, ANSI_UNDERLINE "Commands:" ANSI_UNDERLINE_OFF "\r\n");
+    xSemaphoreTake(s_index_lock, portMAX_DELAY);
+    display_help_span(session, s_root, s_root_count, 0);
+    xSemaphoreGive(s_index_lock);
 }
 
-static void display_error(int index) {
-    outstr(ANSI_COLOR_RED);
-    display_spaces(index + 4);
-    outstr("^?" ANSI_COLOR_OFF "\r\n");
+static void display_error(cli_session_t *session, int index) {
+    outstr(session, ANSI_COLOR_RED);
+    display_spaces(session, index + 4);
+    outstr(session, "^?" ANSI_COLOR_OFF "\r\n");
 }
 
 
 // ----- parser & executor
 
-static int next_space(int index) {
-    while (index < s_buffer_length && s_buffer[index] != ' ') index++;
+static int next_space(cli_session_t *session, int index) {
+    while (index < session->buffer_length && session->buffer[index] != ' ') index++;
     return index;
 }
 
-static int next_nonspace(int index) {
-    while (index < s_buffer_length && s_buffer[index] == ' ') index++;
+static int next_nonspace(cli_session_t *session, int index) {
+    while (index < session->buffer_length && session->buffer[index] == ' ') index++;
     return index;
 }
 
+// compare a command word against `len` chars of `word`: 0 if the command word starts with it.
+static int compare_prefix(const cli_index_t *entry, const uint8_t *word, int len) {
+    int n = entry->word_len < len ? entry->word_len : len;
+    int rv = memcmp(entry->command->name, word, n);
+    if (rv != 0) return rv;
+    return entry->word_len < len ? -1 : 0;
+}
+
+// first entry where `compare_prefix` is >= 0 (or > 0, if `after`)
+static int search(const cli_index_t *entries, int count, const uint8_t *word, int len, bool after) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int rv = compare_prefix(&entries[mid], word, len);
+        if (rv < 0 || (after && rv == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 /*
- * given a command set and an index into the command line, figure out if
- * there's a full or partial match with 1 or more of the commands.
+ * given a sorted run of commands and an index into the command line,
+ * figure out if there's a full or partial match with 1 or more of the
+ * commands.
  *
  * returns true if there's an exact match.
  * if there's an exact or partial match, `matched` will point to the first
@@ -181,526 +270,885 @@ static int next_nonspace(int index) {
  * otherwise, `matched` will be NULL.
  */
 static bool match_command(
-    const cli_command_t * const *command_sets,
-    int command_sets_count,
+    cli_session_t *session,
+    const cli_index_t *entries,
+    int count,
     int index,
-    const cli_command_t **matched,
+    const cli_index_t **matched,
     int *extent
 ) {
     *matched = NULL;
     *extent = 0;
-    if (command_sets == NULL || command_sets_count == 0) return false;
-
-    int end = next_space(index);
-    for (int ci = 0; ci < command_sets_count; ci++) {
-        const cli_command_t *commands = command_sets[ci];
-        for (int c = 0; commands[c].name != NULL; c++) {
-            uint16_t command_len = strlen(commands[c].name);
-
-            if (strncmp((char *)(s_buffer + index), commands[c].name, end - index) != 0) continue;
-            if (end - index == command_len || commands[c].name[end - index] == ' ') {
-                // exact match
-                *matched = &commands[c];
-                *extent = end - index;
-                return true;
-            }
-
-            if (*matched == NULL) {
-                // first partial match: mark the entire command as the extent
-                *matched = &commands[c];
-                *extent = 0;
-                while (commands[c].name[*extent] && commands[c].name[*extent] != ' ') (*extent)++;
-            } else {
-                // not the first partial match: reduce the extent to the common prefix
-                int i = end - index;
-                while (i < command_len && i < *extent && commands[c].name[i] == (*matched)->name[i]) i++;
-                *extent = i;
-            }
-        }
+    if (count == 0) return false;
+
+    int len = next_space(session, index) - index;
+    int first = search(entries, count, session->buffer + index, len, false);
+    int last = search(entries, count, session->buffer + index, len, true) - 1;
+    if (first > last) return false;
+
+    // shorter words sort first, so an exact match would be first.
+    *matched = &entries[first];
+    if (entries[first].word_len == len) {
+        *extent = len;
+        return true;
     }
 
+    // partial match: the extent is the prefix common to every match, which is the prefix of the first and last.
+    const char *a = entries[first].command->name, *b = entries[last].command->name;
+    int i = len;
+    while (i < entries[first].word_len && i < entries[last].word_len && a[i] == b[i]) i++;
+    *extent = i;
+
     if (*extent == 0) *matched = NULL;
     return false;
 }
 
 // modifies the string inline
-static void parse(int index, int *argc, const char **argv) {
+static void parse(cli_session_t *session, int index, int *argc, const char **argv) {
     *argc = 0;
-    while (index < s_buffer_length && *argc <= CLI_MAX_ARGS) {
-        argv[(*argc)++] = (char *)(s_buffer + index);
-        index = next_space(index);
-        s_buffer[index++] = 0;
-        index = next_nonspace(index);
+    while (index < session->buffer_length && *argc < CLI_MAX_ARGS) {
+        argv[(*argc)++] = (char *)(session->buffer + index);
+        // the final arg gets the rest of the line.
+        if (*argc == CLI_MAX_ARGS) break;
+        index = next_space(session, index);
+        session->buffer[index++] = 0;
+        index = next_nonspace(session, index);
     }
 }
 
 // clean up the modified string
-static void unparse(void) {
-    for (int i = 0; i < s_buffer_length; i++) if (s_buffer[i] == 0) s_buffer[i] = ' ';
+static void unparse(cli_session_t *session) {
+    for (int i = 0; i < session->buffer_length; i++) if (session->buffer[i] == 0) session->buffer[i] = ' ';
 }
 
-static void execute(void) {
-    int index = next_nonspace(0);
-    const cli_command_t * const *command_sets = s_command_sets;
-    int command_sets_count = s_command_sets_count;
-    const cli_command_t *match;
+// returns -1 if a command ran, or the index where the line stopped matching any command.
+static int execute(cli_session_t *session) {
+    int index = next_nonspace(session, 0);
+    const cli_index_t *entries = s_root;
+    int count = s_root_count;
+    const cli_index_t *entry;
     int extent = 0;
 
-    while (index < s_buffer_length && match_command(command_sets, command_sets_count, index, &match, &extent)) {
-        if (match == NULL) {
-            display_error(index);
-            display_help();
-            return;
-        }
-
+    xSemaphoreTake(s_index_lock, portMAX_DELAY);
+    while (index < session->buffer_length && match_command(session, entries, count, index, &entry, &extent)) {
+        const cli_command_t *match = entry->command;
         if (match->subcommands == NULL) {
+            xSemaphoreGive(s_index_lock);
             const char *argv[CLI_MAX_ARGS] = { NULL, };
             int argc = 0;
-            parse(index, &argc, argv);
+            parse(session, index, &argc, argv);
             if (match->callback) {
+                // the callback will probably printf, so get our output out of the way first.
+                flush(session);
+                xSemaphoreTakeRecursive(s_command_lock, portMAX_DELAY);
+                trace_begin(match->name);
                 match->callback(match->callback_arg, argc, argv);
+                trace_end(match->name);
+                fflush(stdout);
+                xSemaphoreGiveRecursive(s_command_lock);
             } else {
-                outstr(ANSI_COLOR_GREEN "*** ");
+                outstr(session, ANSI_COLOR_GREEN "*** ");
                 for (int i = 0; i < argc; i++) {
-                    uart_write_bytes(s_cli_uart, argv[i], strlen(argv[i]));
-                    outstr(" ");
+                    out(session, argv[i], strlen(argv[i]));
+                    outstr(session, " ");
                 }
-                outstr(ANSI_COLOR_OFF "\r\n");
+                outstr(session, ANSI_COLOR_OFF "\r\n");
             }
-            unparse();
-            return;
+            unparse(session);
+            return -1;
         }
 
         index += extent;
-        index = next_nonspace(index);
-        command_sets = &match->subcommands;
-        command_sets_count = 1;
+        index = next_nonspace(session, index);
+        entries = &s_subcommands[entry->subcommand_start];
+        count = entry->subcommand_count;
     }
+    xSemaphoreGive(s_index_lock);
+    return index;
+}
 
-    display_error(index);
-    display_help();
-    return;
+static bool is_help(cli_session_t *session) {
+    return (
+        (session->buffer_length >= 1 && session->buffer[0] == '?') ||
+        (session->buffer_length == 4 && memcmp(session->buffer, "help", 4) == 0) ||
+        (session->buffer_length == 4 && memcmp(session->buffer, "menu", 4) == 0)
+    );
 }
 
 
 // ----- history
 
-static int history_length(int index) {
+static int history_length(cli_session_t *session, int index) {
     int end = index;
-    while (s_history[end]) end++;
+    while (session->history[end]) end++;
     return end - index;
 }
 
-static int history_next_from(int index) {
-    while (index < s_history_length && s_history[index]) index++;
-    if (index < s_history_length) index++;
+static int history_next_from(cli_session_t *session, int index) {
+    while (index < session->history_length && session->history[index]) index++;
+    if (index < session->history_length) index++;
     return index;
 }
 
-static int history_previous_from(int index) {
+static int history_previous_from(cli_session_t *session, int index) {
     if (index == 0) return index;
     index -= 2;
-    while (index > 0 && s_history[index]) index--;
+    while (index > 0 && session->history[index]) index--;
     if (index > 0) index++;
     return index;
 }
 
-static void history_drop(int index) {
-    if (index >= s_history_length) return;
-    int len = history_length(index);
+static void history_drop(cli_session_t *session, int index) {
+    if (index >= session->history_length) return;
+    int len = history_length(session, index);
     int end = index + len + 1;
-    memmove(s_history + index, s_history + end, s_history_length - end);
-    s_history_length -= len + 1;
-    if (s_history_index >= index) s_history_index -= len + 1;
+    memmove(session->history + index, session->history + end, session->history_length - end);
+    session->history_length -= len + 1;
+    if (session->history_index >= index) session->history_index -= len + 1;
 }
 
 // save the current line buffer at the end of history, temporarily.
-static void history_save_buffer(void) {
+static void history_save_buffer(cli_session_t *session) {
     // drop history to make room for the newbie:
-    while (CLI_HISTORY_BUFFER_SIZE - s_history_length < s_buffer_length + 1) {
+    while (CLI_HISTORY_BUFFER_SIZE - session->history_length < session->buffer_length + 1) {
         // this can only happen if the current line length is bigger than the entire history buffer:
-        if (s_history_length == 0) return;
-        history_drop(0);
+        if (session->history_length == 0) return;
+        history_drop(session, 0);
     }
 
-    memmove(s_history + s_history_length, s_buffer, s_buffer_length);
-    s_history[s_history_length + s_buffer_length] = 0;
+    memmove(session->history + session->history_length, session->buffer, session->buffer_length);
+    session->history[session->history_length + session->buffer_length] = 0;
 }
 
 // copy the saved line buffer back.
-static void history_restore_buffer(void) {
-    s_buffer_length = history_length(s_history_length);
-    memmove(s_buffer, s_history + s_history_length, s_buffer_length);
+static void history_restore_buffer(cli_session_t *session) {
+    session->buffer_length = history_length(session, session->history_length);
+    memmove(session->buffer, session->history + session->history_length, session->buffer_length);
 }
 
-static void history_add(void) {
+static void history_add(cli_session_t *session) {
     // remove any history item that's identical.
     int index = 0;
-    while (index < s_history_length) {
-        int len = history_length(index);
-        if (len == s_cursor && memcmp(s_history + index, s_buffer, len) == 0) {
-            history_drop(index);
+    while (index < session->history_length) {
+        int len = history_length(session, index);
+        if (len == session->cursor && memcmp(session->history + index, session->buffer, len) == 0) {
+            history_drop(session, index);
         } else {
             index += len + 1;
         }
     }
 
-    history_save_buffer();
-    s_history_length += s_buffer_length + 1;
-    s_history_index = s_history_length;
-    s_history_active = false;
+    history_save_buffer(session);
+    session->history_length += session->buffer_length + 1;
+    session->history_index = session->history_length;
+    session->history_active = false;
 }
 
-static void history_previous(void) {
-    if (s_history_index == 0) return;
-    if (!s_history_active) {
-        history_save_buffer();
-        s_history_active = true;
+static void history_previous(cli_session_t *session) {
+    if (session->history_index == 0) return;
+    if (!session->history_active) {
+        history_save_buffer(session);
+        session->history_active = true;
     }
-    s_history_index = history_previous_from(s_history_index);
-    s_buffer_length = history_length(s_history_index);
-    memmove(s_buffer, s_history + s_history_index, s_buffer_length);
-    s_cursor = s_buffer_length;
+    session->history_index = history_previous_from(session, session->history_index);
+    session->buffer_length = history_length(session, session->history_index);
+    memmove(session->buffer, session->history + session->history_index, session->buffer_length);
+    session->cursor = session->buffer_length;
 }
 
-static void history_next(void) {
-    if (!s_history_active) return;
-    s_history_index = history_next_from(s_history_index);
-    if (s_history_index == s_history_length) {
-        history_restore_buffer();
-        s_cursor = s_buffer_length;
-        s_history_active = false;
+static void history_next(cli_session_t *session) {
+    if (!session->history_active) return;
+    session->history_index = history_next_from(session, session->history_index);
+    if (session->history_index == session->history_length) {
+        history_restore_buffer(session);
+        session->cursor = session->buffer_length;
+        session->history_active = false;
         return;
     }
-    s_buffer_length = history_length(s_history_index);
-    memmove(s_buffer, s_history + s_history_index, s_buffer_length);
-    s_cursor = s_buffer_length;
+    session->buffer_length = history_length(session, session->history_index);
+    memmove(session->buffer, session->history + session->history_index, session->buffer_length);
+    session->cursor = session->buffer_length;
 }
 
-static void history_stop(void) {
-    s_history_index = s_history_length;
+static void history_stop(cli_session_t *session) {
+    session->history_index = session->history_length;
 }
 
 
 // ----- key actions
 
-static void insert(uint8_t c) {
+static void insert(cli_session_t *session, uint8_t c) {
     // leave a byte for zero-terminating it later:
-    if (s_buffer_length < CLI_BUFFER_SIZE - 1) s_buffer_length++;
-    for (int i = s_buffer_length - 1; i > s_cursor; i--) s_buffer[i] = s_buffer[i - 1];
-    if (s_cursor < CLI_BUFFER_SIZE - 1) {
-        s_buffer[s_cursor++] = c;
-        uart_write_bytes(s_cli_uart, &c, 1);
+    if (session->buffer_length < CLI_BUFFER_SIZE - 1) session->buffer_length++;
+    for (int i = session->buffer_length - 1; i > session->cursor; i--) session->buffer[i] = session->buffer[i - 1];
+    if (session->cursor < CLI_BUFFER_SIZE - 1) {
+        session->buffer[session->cursor++] = c;
+        out(session, &c, 1);
     }
-    if (s_cursor < s_buffer_length) uart_write_bytes(s_cli_uart, &s_buffer[s_cursor], s_buffer_length - s_cursor);
-    move_left(s_buffer_length - s_cursor);
+    if (session->cursor < session->buffer_length) out(session, &session->buffer[session->cursor], session->buffer_length - session->cursor);
+    move_left(session, session->buffer_length - session->cursor);
 }
 
-static void left(void) {
-    if (s_cursor == 0) return;
-    s_cursor--;
-    csi_move(1, 'D');
+static void left(cli_session_t *session) {
+    if (session->cursor == 0) return;
+    session->cursor--;
+    csi_move(session, 1, 'D');
 }
 
-static void right(void) {
-    if (s_cursor == s_buffer_length) return;
-    s_cursor++;
-    csi_move(1, 'C');
+static void right(cli_session_t *session) {
+    if (session->cursor == session->buffer_length) return;
+    session->cursor++;
+    csi_move(session, 1, 'C');
 }
 
-static void home(void) {
-    move_left(s_cursor);
-    s_cursor = 0;
+static void home(cli_session_t *session) {
+    move_left(session, session->cursor);
+    session->cursor = 0;
 }
 
-static void end(void) {
-    move_right(s_buffer_length - s_cursor);
-    s_cursor = s_buffer_length;
+static void end(cli_session_t *session) {
+    move_right(session, session->buffer_length - session->cursor);
+    session->cursor = session->buffer_length;
 }
 
-static void del(void) {
-    if (s_buffer_length > s_cursor) s_buffer_length--;
-    for (int i = s_cursor; i < s_buffer_length; i++) {
-        s_buffer[i] = s_buffer[i + 1];
-        uart_write_bytes(s_cli_uart, &s_buffer[i], 1);
+static void del(cli_session_t *session) {
+    if (session->buffer_length > session->cursor) session->buffer_length--;
+    for (int i = session->cursor; i < session->buffer_length; i++) {
+        session->buffer[i] = session->buffer[i + 1];
+        out(session, &session->buffer[i], 1);
     }
-    outstr(" ");
-    move_left(s_buffer_length - s_cursor + 1);
+    outstr(session, " ");
+    move_left(session, session->buffer_length - session->cursor + 1);
 }
 
-static void bs(void) {
-    if (s_cursor == 0) return;
-    s_cursor--;
-    outstr("\b \b");
-    if (s_cursor < s_buffer_length) {
-        del();
+static void bs(cli_session_t *session) {
+    if (session->cursor == 0) return;
+    session->cursor--;
+    outstr(session, "\b \b");
+    if (session->cursor < session->buffer_length) {
+        del(session);
     } else {
-        s_buffer_length--;
+        session->buffer_length--;
     }
 }
 
-static void deleol(void) {
-    for (int i = s_cursor; i < s_buffer_length; i++) outstr(" ");
-    move_left(s_buffer_length - s_cursor);
-    s_buffer_length = s_cursor;
+static void deleol(cli_session_t *session) {
+    for (int i = session->cursor; i < session->buffer_length; i++) outstr(session, " ");
+    move_left(session, session->buffer_length - session->cursor);
+    session->buffer_length = session->cursor;
 }
 
-static void delword(void) {
-    while (s_cursor > 0 && s_buffer[s_cursor - 1] == ' ') bs();
-    while (s_cursor > 0 && s_buffer[s_cursor - 1] != ' ') bs();
+static void delword(cli_session_t *session) {
+    while (session->cursor > 0 && session->buffer[session->cursor - 1] == ' ') bs(session);
+    while (session->cursor > 0 && session->buffer[session->cursor - 1] != ' ') bs(session);
 }
 
-static void transpose(void) {
-    if (s_cursor == 0 || s_cursor == s_buffer_length) return;
-    uint8_t c = s_buffer[s_cursor - 1];
-    s_buffer[s_cursor - 1] = s_buffer[s_cursor];
-    s_buffer[s_cursor] = c;
-    move_left(1);
-    uart_write_bytes(s_cli_uart, &s_buffer[s_cursor - 1], 2);
-    move_left(1);
+static void transpose(cli_session_t *session) {
+    if (session->cursor == 0 || session->cursor == session->buffer_length) return;
+    uint8_t c = session->buffer[session->cursor - 1];
+    session->buffer[session->cursor - 1] = session->buffer[session->cursor];
+    session->buffer[session->cursor] = c;
+    move_left(session, 1);
+    out(session, &session->buffer[session->cursor - 1], 2);
+    move_left(session, 1);
 }
 
-static void reset(void) {
-    clear_line();
-    display_prompt();
-    s_cursor = 0;
-    s_buffer_length = 0;
-    history_stop();
+static void reset(cli_session_t *session) {
+    clear_line(session);
+    display_prompt(session);
+    session->cursor = 0;
+    session->buffer_length = 0;
+    history_stop(session);
 }
 
-static void redraw(void) {
-    clear_line();
-    display_prompt();
-    uart_write_bytes(s_cli_uart, s_buffer, s_buffer_length);
-    move_left(s_buffer_length - s_cursor);
+static void redraw(cli_session_t *session) {
+    clear_line(session);
+    display_prompt(session);
+    out(session, session->buffer, session->buffer_length);
+    move_left(session, session->buffer_length - session->cursor);
 }
 
-static void tab(void) {
-    int index = next_nonspace(0);
-    const cli_command_t * const *command_sets = s_command_sets;
-    int command_sets_count = s_command_sets_count;
+static void tab(cli_session_t *session) {
+    int index = next_nonspace(session, 0);
+    const cli_index_t *entries = s_root;
+    int count = s_root_count;
 
-    while (index < s_cursor) {
-        const cli_command_t *match;
+    xSemaphoreTake(s_index_lock, portMAX_DELAY);
+    while (index < session->cursor) {
+        const cli_index_t *entry;
         int extent = 0;
-        if (match_command(command_sets, command_sets_count, index, &match, &extent)) {
+        if (match_command(session, entries, count, index, &entry, &extent)) {
             // exact match.
             index += extent;
-            while (index < s_cursor && s_buffer[index] == ' ') index++;
-            command_sets = &match->subcommands;
-            command_sets_count = 1;
-            if (index == s_cursor || command_sets == NULL) {
-                if (s_buffer[index - 1] != ' ') insert(' ');
-                return;
+            while (index < session->cursor && session->buffer[index] == ' ') index++;
+            entries = &s_subcommands[entry->subcommand_start];
+            count = entry->subcommand_count;
+            if (index == session->cursor || count == 0) {
+                if (session->buffer[index - 1] != ' ') insert(session, ' ');
+                break;
             }
             continue;
         }
-        if (!match) return;
+        if (!entry) break;
 
-        int end = next_space(index);
+        const cli_command_t *match = entry->command;
+        int end = next_space(session, index);
         // if we found an autocomplete, but it's for some prior word, give up.
-        if (end < s_cursor) return;
+        if (end < session->cursor) break;
         // move the cursor along chars that are already matches.
         while (
-            s_cursor < index + extent &&
-            s_cursor < s_buffer_length &&
-            s_buffer[s_cursor] == match->name[s_cursor - index]
+            session->cursor < index + extent &&
+            session->cursor < session->buffer_length &&
+            session->buffer[session->cursor] == match->name[session->cursor - index]
         ) {
-            s_cursor++;
-            move_right(1);
+            session->cursor++;
+            move_right(session, 1);
         }
-        while (s_cursor < index + extent) insert(match->name[s_cursor - index]);
-        bool has_args = (match->name[s_cursor - index] == ' ');
-        bool full_match = has_args || (match->name[s_cursor - index] == 0);
-        if ((match->subcommands || has_args) && full_match && s_cursor == s_buffer_length) insert(' ');
-        return;
+        while (session->cursor < index + extent) insert(session, match->name[session->cursor - index]);
+        bool has_args = (match->name[session->cursor - index] == ' ');
+        bool full_match = has_args || (match->name[session->cursor - index] == 0);
+        if ((match->subcommands || has_args) && full_match && session->cursor == session->buffer_length) insert(session, ' ');
+        break;
     }
+    xSemaphoreGive(s_index_lock);
 }
 
-static void commit(void) {
-    s_buffer[s_buffer_length] = 0;
-    move_right(s_buffer_length - s_cursor);
-    outstr("\r\n");
-    if (
-        (s_buffer_length >= 1 && s_buffer[0] == '?') ||
-        (s_buffer_length == 4 && memcmp(s_buffer, "help", 4) == 0) ||
-        (s_buffer_length == 4 && memcmp(s_buffer, "menu", 4) == 0)
-    ) {
-        display_help();
-        history_add();
-    } else if (s_buffer_length > 0) {
-        execute();
-        history_add();
+static void commit(cli_session_t *session) {
+    session->buffer[session->buffer_length] = 0;
+    move_right(session, session->buffer_length - session->cursor);
+    outstr(session, "\r\n");
+    if (is_help(session)) {
+        display_help(session);
+        history_add(session);
+    } else if (session->buffer_length > 0) {
+        int index = execute(session);
+        if (index >= 0) {
+            display_error(session, index);
+            display_help(session);
+        }
+        history_add(session);
     }
 
-    reset();
+    reset(session);
 }
 
-static void process_key(uint8_t key) {
-    switch (s_csi_state) {
+static void process_key(cli_session_t *session, uint8_t key) {
+    switch (session->csi_state) {
         case 0:
             switch (key) {
                 case 0x01:  // C-a
-                    home();
+                    home(session);
                     break;
                 case 0x02:  // C-b
-                    left();
+                    left(session);
                     break;
                 case 0x03:  // C-c
-                    outstr(ANSI_BOLD "^C" ANSI_BOLD_OFF "\r\n");
-                    reset();
+                    outstr(session, ANSI_BOLD "^C" ANSI_BOLD_OFF "\r\n");
+                    reset(session);
                     break;
                 case 0x04:  // C-d
-                    del();
+                    del(session);
                     break;
                 case 0x05:  // C-e
-                    end();
+                    end(session);
                     break;
                 case 0x06:  // C-f
-                    right();
+                    right(session);
                     break;
                 case 0x08:  // C-h (bs)
-                    bs();
+                    bs(session);
                     break;
                 case 0x09:  // C-i (tab)
-                    tab();
+                    tab(session);
                     break;
                 case 0x0b:  // C-k
-                    deleol();
+                    deleol(session);
                     break;
                 case 0x0c:  // C-l
-                    redraw();
+                    redraw(session);
                     break;
                 case 0x0d:  // C-m (enter)
-                    commit();
+                    commit(session);
                     break;
                 case 0x12:  // C-r
-                    redraw();
+                    redraw(session);
                     break;
                 case 0x14:  // C-t
-                    transpose();
+                    transpose(session);
                     break;
                 case 0x15:  // C-u
-                    reset();
+                    reset(session);
                     break;
                 case 0x17:  // C-w
-                    delword();
+                    delword(session);
                     break;
                 case 0x1b:  // ESC
-                    s_csi_state++;
+                    session->csi_state++;
                     break;
                 case 0x7f:  // DEL
-                    bs();
+                    bs(session);
                     break;
                 default:
                     if (key >= 0x20 && key <= 0x7e) {
-                        insert(key);
+                        insert(session, key);
                     }
             }
             break;
         case 1:
             switch (key) {
                 case '[':
-                    s_csi_state++;
-                    s_csi_param = 0;
+                    session->csi_state++;
+                    session->csi_param = 0;
                     break;
                 default:
                     // ignore ESC
-                    s_csi_state = 0;
-                    process_key(key);
+                    session->csi_state = 0;
+                    process_key(session, key);
             }
             break;
         case 2:
             switch (key) {
                 case ';':
                     // too complex for us, ignore.
-                    s_csi_param = 0;
+                    session->csi_param = 0;
                     break;
                 case 'A':
-                    history_previous();
-                    redraw();
-                    s_csi_state = 0;
+                    history_previous(session);
+                    redraw(session);
+                    session->csi_state = 0;
                     break;
                 case 'B':
-                    history_next();
-                    redraw();
-                    s_csi_state = 0;
+                    history_next(session);
+                    redraw(session);
+                    session->csi_state = 0;
                     break;
                 case 'C':
-                    right();
-                    s_csi_state = 0;
+                    right(session);
+                    session->csi_state = 0;
                     break;
                 case 'D':
-                    left();
-                    s_csi_state = 0;
+                    left(session);
+                    session->csi_state = 0;
                     break;
                 case 'F':
-                    end();
-                    s_csi_state = 0;
+                    end(session);
+                    session->csi_state = 0;
                     break;
                 case 'H':
-                    home();
-                    s_csi_state = 0;
+                    home(session);
+                    session->csi_state = 0;
                     break;
                 case '~':
-                    switch (s_csi_param) {
+                    switch (session->csi_param) {
                         case 1:
-                            home();
+                            home(session);
                             break;
                         case 3:
-                            del();
+                            del(session);
                             break;
                         case 4:
-                            end();
+                            end(session);
                             break;
                     }
-                    s_csi_state = 0;
+                    session->csi_state = 0;
                     break;
                 default:
                     if (key >= '0' && key <= '9') {
-                        s_csi_param = s_csi_param * 10 + (key - '0');
+                        session->csi_param = session->csi_param * 10 + (key - '0');
                     } else {
                         // ignore ESC
-                        s_csi_state = 0;
-                        process_key('[');
-                        process_key(key);
+                        session->csi_state = 0;
+                        process_key(session, '[');
+                        process_key(session, key);
                     }
             }
             break;
     }
 }
 
+
+// ----- sessions
+
+static void session_start(cli_session_t *session, cli_write_t write, int socket) {
+    memset(session, 0, sizeof(cli_session_t));
+    session->socket = socket;
+    session->write = write;
+}
+
+// find the session for the task that's running a command
+static cli_session_t *current_session(void) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < CLI_MAX_TCP_SESSIONS; i++) {
+        if (s_tcp_sessions[i].socket >= 0 && s_tcp_sessions[i].task == task) return &s_tcp_sessions[i];
+    }
+    return &s_uart_session;
+}
+
+static void uart_write(cli_session_t *session, const uint8_t *data, size_t len) {
+    uart_write_bytes(s_cli_uart, (const char *) data, len);
+}
+
 static void cli_task(QueueHandle_t queue) {
+    cli_session_t *session = &s_uart_session;
     uart_event_t event;
-    uint8_t ch;
+    uint8_t keys[32];
+    int count;
 
+    session->task = xTaskGetCurrentTaskHandle();
     while (true) {
         if (xQueueReceive(queue, &event, pdMS_TO_TICKS(portMAX_DELAY))) {
-            while (uart_read_bytes(s_cli_uart, &ch, 1, 0) > 0) process_key(ch);
+            while ((count = uart_read_bytes(s_cli_uart, keys, sizeof(keys), 0)) > 0) {
+                for (int i = 0; i < count; i++) process_key(session, keys[i]);
+            }
+            flush(session);
         }
     }
 }
 
+static void tcp_write(cli_session_t *session, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        int n = send(session->socket, data, len, 0);
+        // the read side will notice the connection is gone.
+        if (n <= 0) return;
+        data += n, len -= n;
+    }
+}
+
+// printf from a command callback lands here, for sessions that aren't the console.
+static int stream_write(void *cookie, const char *data, int len) {
+    cli_session_t *session = cookie;
+    int start = 0;
+    for (int i = 0; i < len; i++) {
+        if (data[i] != '\n') continue;
+        out(session, data + start, i - start);
+        outstr(session, "\r\n");
+        start = i + 1;
+    }
+    out(session, data + start, len - start);
+    return len;
+}
+
+// strip telnet negotiation out of the input stream, and treat a bare LF as enter.
+static void tcp_key(cli_session_t *session, uint8_t key) {
+    uint8_t last_key = session->last_key;
+    session->last_key = key;
+    switch (session->telnet_state) {
+        case 0:
+            if (key == TELNET_IAC) {
+                session->telnet_state = 1;
+            } else if (key == '\n') {
+                if (last_key != '\r') process_key(session, '\r');
+            } else {
+                process_key(session, key);
+            }
+            break;
+        case 1:
+            if (key >= TELNET_WILL && key <= TELNET_DONT) {
+                session->telnet_state = 2;
+            } else if (key == TELNET_SB) {
+                session->telnet_state = 3;
+            } else {
+                session->telnet_state = 0;
+            }
+            break;
+        case 2:
+            session->telnet_state = 0;
+            break;
+        case 3:
+            if (key == TELNET_IAC) session->telnet_state = 4;
+            break;
+        case 4:
+            session->telnet_state = (key == TELNET_SE) ? 0 : 3;
+            break;
+    }
+}
+
+static void tcp_session_task(void *arg) {
+    cli_session_t *session = arg;
+    uint8_t keys[32];
+    int count;
+
+    session->task = xTaskGetCurrentTaskHandle();
+    // this task's stdout is its own, so commands' printf goes back over the connection.
+    stdout = fwopen(session, stream_write);
+
+    // we echo, and we want each key as it's typed.
+    static const uint8_t negotiate[] = { TELNET_IAC, TELNET_WILL, TELNET_ECHO, TELNET_IAC, TELNET_WILL, TELNET_SGA };
+    out(session, negotiate, sizeof(negotiate));
+    display_prompt(session);
+    flush(session);
+
+    while ((count = recv(session->socket, keys, sizeof(keys), 0)) > 0) {
+        for (int i = 0; i < count; i++) tcp_key(session, keys[i]);
+        flush(session);
+    }
+
+    fclose(stdout);
+    close(session->socket);
+    session->write = NULL;
+    session->socket = -1;
+    vTaskDelete(NULL);
+}
+
+static void tcp_listen_task(void *arg) {
+    int port = (intptr_t) arg;
+    int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+        printf("cli: can't listen on port %d (%d)\n", port, errno);
+        if (listener >= 0) close(listener);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (true) {
+        struct sockaddr_in remote;
+        socklen_t remote_len = sizeof(remote);
+        int sock = accept(listener, (struct sockaddr *) &remote, &remote_len);
+        if (sock < 0) continue;
+        // notice dead connections eventually, so they give up their slot.
+        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+
+        cli_session_t *session = NULL;
+        for (int i = 0; i < CLI_MAX_TCP_SESSIONS; i++) {
+            if (s_tcp_sessions[i].socket < 0) {
+                session = &s_tcp_sessions[i];
+                break;
+            }
+        }
+        if (session == NULL) {
+            static const char busy[] = "too many sessions\r\n";
+            send(sock, busy, sizeof(busy) - 1, 0);
+            close(sock);
+            continue;
+        }
+
+        printf("cli: session from %s\n", inet_ntoa(remote.sin_addr));
+        session_start(session, tcp_write, sock);
+        TaskHandle_t task;
+        if (xTaskCreate(
+            tcp_session_task, "cli-tcp", CLI_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), session,
+            tskIDLE_PRIORITY, &task
+        ) != pdPASS) {
+            close(sock);
+            session->write = NULL;
+            session->socket = -1;
+        }
+    }
+}
+
+
+// ----- scripts
+
+static void send_held(cli_session_t *session) {
+    if (session->held_length == 0) return;
+    session->output(session->output_context, (const char *) session->held, session->held_length);
+    session->held_length = 0;
+}
+
+// hold output until the line is done, so a slow reader can't stall a command (which has the command lock).
+static void script_write(cli_session_t *session, const uint8_t *data, size_t len) {
+    if (session->held != NULL && session->held_length + len <= POOL_BLOCK_SIZE) {
+        memcpy(session->held + session->held_length, data, len);
+        session->held_length += len;
+        return;
+    }
+    // a lot of output: it'll have to go now.
+    send_held(session);
+    session->output(session->output_context, (const char *) data, len);
+}
+
+// when there's nowhere else for output to go, it goes wherever this task's stdout goes.
+static void stdout_write(void *context, const char *data, size_t len) {
+    fwrite(data, 1, len, stdout);
+}
+
+// run one line of a script from the edit buffer, echoing it and timing it. returns false if it failed.
+static bool script_line(cli_session_t *session) {
+    display_prompt(session);
+    out(session, session->buffer, session->buffer_length);
+    outstr(session, "\r\n");
+    session->buffer[session->buffer_length] = 0;
+    if (is_help(session)) {
+        display_help(session);
+        return true;
+    }
+
+    int64_t start = esp_timer_get_time();
+    int index = execute(session);
+    uint32_t elapsed = (uint32_t) (esp_timer_get_time() - start);
+    if (index >= 0) {
+        display_error(session, index);
+        return false;
+    }
+
+    char line[32];
+    int len = snprintf(line, sizeof(line), "(%u.%03u ms)\r\n", elapsed / 1000, elapsed % 1000);
+    out(session, line, len);
+    return true;
+}
+
 
 // ----- API
 
+static int compare_entries(const cli_index_t *a, const cli_index_t *b) {
+    int n = a->word_len < b->word_len ? a->word_len : b->word_len;
+    int rv = memcmp(a->command->name, b->command->name, n);
+    return rv != 0 ? rv : a->word_len - b->word_len;
+}
+
+// insert into a sorted run, after any equal entries (so the first one registered wins).
+static void insert_sorted(cli_index_t *entries, int count, const cli_index_t *entry) {
+    int i = count;
+    while (i > 0 && compare_entries(&entries[i - 1], entry) > 0) {
+        entries[i] = entries[i - 1];
+        i--;
+    }
+    entries[i] = *entry;
+}
+
+// fill in an index entry, compiling its subcommands (recursively) into `s_subcommands`.
+static bool compile(const cli_command_t *command, cli_index_t *entry) {
+    entry->command = command;
+    entry->word_len = 0;
+    while (command->name[entry->word_len] && command->name[entry->word_len] != ' ') entry->word_len++;
+    entry->subcommand_start = s_subcommands_count;
+    entry->subcommand_count = 0;
+    if (command->subcommands == NULL) return true;
+
+    // reserve a contiguous run for the subcommands, then fill it in sorted order.
+    int count = 0;
+    while (command->subcommands[count].name != NULL) count++;
+    if (s_subcommands_count + count > CLI_MAX_SUBCOMMANDS) return false;
+    cli_index_t *run = &s_subcommands[s_subcommands_count];
+    s_subcommands_count += count;
+    for (int i = 0; i < count; i++) {
+        cli_index_t sub;
+        if (!compile(&command->subcommands[i], &sub)) return false;
+        insert_sorted(run, i, &sub);
+    }
+    entry->subcommand_count = count;
+    return true;
+}
+
 void cli_init(uart_port_t uart, const cli_command_t *commands) {
     QueueHandle_t queue;
-    ESP_ERROR_CHECK(uart_driver_install(uart, CLI_RX_BUFFER_SIZE, 0, CLI_RX_QUEUE_SIZE, &queue, 0));
+    ESP_ERROR_CHECK(uart_driver_install(uart, CLI_RX_BUFFER_SIZE, CLI_TX_BUFFER_SIZE, CLI_RX_QUEUE_SIZE, &queue, 0));
     s_cli_uart = uart;
+    if (s_index_lock == NULL) s_index_lock = xSemaphoreCreateMutex();
+    s_command_lock = xSemaphoreCreateRecursiveMutex();
+    for (int i = 0; i < CLI_MAX_TCP_SESSIONS; i++) s_tcp_sessions[i].socket = -1;
+    session_start(&s_uart_session, uart_write, -1);
 
     TaskHandle_t task;
     xTaskCreate(cli_task, "CLI", CLI_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), queue, tskIDLE_PRIORITY, &task);
-    display_prompt();
+    display_prompt(&s_uart_session);
+    flush(&s_uart_session);
     if (commands != NULL) cli_register_commands(commands);
 }
 
+// claim a script session for this task, or NULL if it's nested too deep or they're all taken
+static cli_session_t *claim_script_session(void) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    int free_slot = -1, depth = 0;
+    portENTER_CRITICAL(&s_script_lock);
+    for (int i = 0; i < CLI_MAX_SCRIPTS; i++) {
+        if (s_script_tasks[i] == NULL) {
+            if (free_slot < 0) free_slot = i;
+        } else if (s_script_tasks[i] == task) {
+            depth++;
+        }
+    }
+    if (depth >= CLI_MAX_SCRIPT_DEPTH) free_slot = -1;
+    if (free_slot >= 0) s_script_tasks[free_slot] = task;
+    portEXIT_CRITICAL(&s_script_lock);
+    if (free_slot < 0) printf("!!! %s\n", depth >= CLI_MAX_SCRIPT_DEPTH ? "scripts nested too deep" : "too many scripts running");
+    return free_slot < 0 ? NULL : &s_script_sessions[free_slot];
+}
+
+static void release_script_session(cli_session_t *session) {
+    portENTER_CRITICAL(&s_script_lock);
+    s_script_tasks[session - s_script_sessions] = NULL;
+    portEXIT_CRITICAL(&s_script_lock);
+}
+
+int cli_run_script(const char *script, cli_output_t output, void *context) {
+    // scripts only take the command lock for each command they run, so nesting is counted per task.
+    cli_session_t *session = claim_script_session();
+    if (session == NULL) return 1;
+    session_start(session, script_write, -1);
+    session->output = output ? output : stdout_write;
+    session->output_context = context;
+    // nested scripts write to the outer one's stdout, which holds their output already.
+    session->held = output ? pool_alloc(POOL_BLOCK_SIZE) : NULL;
+
+    // printf from the commands should go to the same place as the rest of the output. (stdout is per task.)
+    FILE *saved_stdout = stdout;
+    if (output) stdout = fwopen(session, stream_write);
+
+    int64_t start = esp_timer_get_time();
+    int commands = 0, failed = 0;
+    const char *p = script;
+    while (*p) {
+        const char *end = p;
+        while (*end && *end != ';' && *end != '\n' && *end != '\r') end++;
+        while (p < end && *p == ' ') p++;
+        int len = end - p;
+        while (len > 0 && p[len - 1] == ' ') len--;
+        // skip blank lines and comments
+        if (len > 0 && *p != '#') {
+            if (len > CLI_BUFFER_SIZE - 1) len = CLI_BUFFER_SIZE - 1;
+            memcpy(session->buffer, p, len);
+            session->buffer_length = session->cursor = len;
+            commands++;
+            if (!script_line(session)) failed++;
+            flush(session);
+            send_held(session);
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    uint32_t elapsed = (uint32_t) (esp_timer_get_time() - start);
+    char line[64];
+    int len = snprintf(line, sizeof(line), "%d commands, %d failed, %u.%03u ms\r\n", commands, failed, elapsed / 1000, elapsed % 1000);
+    out(session, line, len);
+    flush(session);
+    send_held(session);
+
+    if (output) {
+        fclose(stdout);
+        stdout = saved_stdout;
+    }
+    if (session->held != NULL) pool_free(session->held);
+    release_script_session(session);
+    return failed;
+}
+
+void cli_listen(uint16_t port) {
+    TaskHandle_t task;
+    xTaskCreate(tcp_listen_task, "cli-listen", CLI_LISTEN_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), (void *) (intptr_t) port, tskIDLE_PRIORITY, &task);
+}
+
 void cli_register_commands(const cli_command_t *commands) {
-    if (s_command_sets_count == CLI_MAX_COMMAND_SETS) {
-        outstr("!!! Too many console command sets registered; increase CLI_MAX_COMMAND_SETS\r\n");
-        return;
+    // the first registration happens from app_main, before any other task could be registering.
+    if (s_index_lock == NULL) s_index_lock = xSemaphoreCreateMutex();
+
+    xSemaphoreTake(s_index_lock, portMAX_DELAY);
+    for (int c = 0; commands[c].name != NULL; c++) {
+        cli_index_t entry;
+        if (s_root_count == CLI_MAX_COMMANDS || !compile(&commands[c], &entry)) {
+            printf("!!! Too many console commands registered; increase CLI_MAX_COMMANDS/CLI_MAX_SUBCOMMANDS\n");
+            break;
+        }
+        insert_sorted(s_root, s_root_count++, &entry);
     }
-    s_command_sets[s_command_sets_count++] = commands;
+    xSemaphoreGive(s_index_lock);
 }
 
 bool cli_is_truthy(const char *s) {
@@ -711,5 +1159,19 @@ bool cli_is_truthy(const char *s) {
 }
 
 void cli_display_help(void) {
-    display_help();
+    cli_session_t *session = current_session();
+    display_help(session);
+    flush(session);
+}
+
+void cli_sleep(uint32_t ms) {
+    fflush(stdout);
+    // the lock is recursive, and a macro running this command holds it more than once.
+    int depth = 0;
+    while (xSemaphoreGetMutexHolder(s_command_lock) == xTaskGetCurrentTaskHandle()) {
+        xSemaphoreGiveRecursive(s_command_lock);
+        depth++;
+    }
+    vTaskDelay(pdMS_TO_TICKS(ms));
+    while (depth-- > 0) xSemaphoreTakeRecursive(s_command_lock, portMAX_DELAY);
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "driver/uart.h"
 
 // prompt
 #ifndef CLI_PROMPT
@@ -28,6 +30,16 @@
 #define CLI_RX_BUFFER_SIZE 256
 #endif
 
+// how much space to use for buffering UART output (writes only block when it's full)
+#ifndef CLI_TX_BUFFER_SIZE
+#define CLI_TX_BUFFER_SIZE 1024
+#endif
+
+// how many bytes of output to collect before handing them to the UART
+#ifndef CLI_OUTPUT_BUFFER_SIZE
+#define CLI_OUTPUT_BUFFER_SIZE 256
+#endif
+
 // number of "events" to allow to be enqueued (doesn't matter)
 #ifndef CLI_RX_QUEUE_SIZE
 #define CLI_RX_QUEUE_SIZE 8
@@ -38,14 +50,40 @@
 #define CLI_TASK_STACK_SIZE 4096
 #endif
 
-// maximum slots for calls to `cli_register_commands` (each call uses one slot)
-#ifndef CLI_MAX_COMMAND_SETS
-#define CLI_MAX_COMMAND_SETS 16
+/*
+ * how many TCP sessions can be connected at once (each one gets its own
+ * task). each is a socket, as is the listener, and they come out of
+ * CONFIG_LWIP_MAX_SOCKETS (16) along with httpd's (2 + up to 7 clients)
+ * and the ones timesync and ddp keep open.
+ */
+#ifndef CLI_MAX_TCP_SESSIONS
+#define CLI_MAX_TCP_SESSIONS 2
 #endif
 
-// when displaying help, how many commands can we collect/sort in place?
-// (it will allocate this many pointers on the stack, so 64 = 256 bytes on the stack)
-#define CLI_MAX_COLLECT 64
+// stack used by the task that accepts TCP sessions
+#ifndef CLI_LISTEN_TASK_STACK_SIZE
+#define CLI_LISTEN_TASK_STACK_SIZE 2560
+#endif
+
+// how deep can scripts run scripts (like a macro that runs a macro)?
+#ifndef CLI_MAX_SCRIPT_DEPTH
+#define CLI_MAX_SCRIPT_DEPTH 4
+#endif
+
+// how many scripts can run at once, nested or on different tasks. each reserves a session (~700 bytes).
+#ifndef CLI_MAX_SCRIPTS
+#define CLI_MAX_SCRIPTS (CLI_MAX_SCRIPT_DEPTH + 2)
+#endif
+
+// maximum top-level commands, across all calls to `cli_register_commands` (8 bytes each)
+#ifndef CLI_MAX_COMMANDS
+#define CLI_MAX_COMMANDS 64
+#endif
+
+// maximum subcommands, at any depth, across all registered commands (8 bytes each)
+#ifndef CLI_MAX_SUBCOMMANDS
+#define CLI_MAX_SUBCOMMANDS 128
+#endif
 // where should the help text be displayed, horizontally?
 #define CLI_HELP_LEFT_PAD 40
 // when parsing, args after this are just packed together into the final arg.
@@ -80,12 +118,36 @@ typedef struct cli_command {
 
 #define CLI_LAST_COMMAND { NULL, NULL, NULL, NULL, NULL }
 
+// receives output from `cli_run_script`
+typedef void (*cli_output_t)(void *context, const char *data, size_t len);
+
 /*
  * setup CLI and pass in an (optional) list of supported commands.
  * commands can be added later with `cli_register_commands`.
  */
 void cli_init(uart_port_t uart, const cli_command_t *commands);
 
+/*
+ * accept telnet-style CLI sessions on a TCP port, alongside the UART.
+ * each session has its own line editor and history, and output from the
+ * commands it runs goes back to it. there's no login, so only do this on
+ * a network you trust.
+ */
+void cli_listen(uint16_t port);
+
+/*
+ * run a batch of commands, separated by ';' or newlines, as if they'd been
+ * typed in one at a time. blank lines and lines starting with '#' are
+ * skipped. each command is echoed, followed by its output and how long it
+ * took, and there's a summary line at the end. output goes to `output`, or
+ * to stdout if it's NULL.
+ *
+ * commands run on the calling task, taking turns with other sessions one
+ * command at a time. each line's output is held until it's done, so a slow
+ * reader doesn't keep anyone else waiting. returns the number that failed.
+ */
+int cli_run_script(const char *script, cli_output_t output, void *context);
+
 /*
  * append a set of commands to the list, if there's room.
  * modules can use this to add their own commands to the CLI as they init.
@@ -102,3 +164,9 @@ bool cli_is_truthy(const char *s);
  * display the help screen as if someone typed "?".
  */
 void cli_display_help(void);
+
+/*
+ * for commands that wait around (like `top`): flush their output and sleep,
+ * letting other sessions run commands in the meantime.
+ */
+void cli_sleep(uint32_t ms);
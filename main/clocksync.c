@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "clocksync.h"
+
+void clocksync_init(clocksync_t *sync, uint64_t id) {
+    memset(sync, 0, sizeof(*sync));
+    sync->id = id;
+    sync->leader_id = id;
+}
+
+bool clocksync_is_leader(const clocksync_t *sync, int64_t now) {
+    return sync->leader_id == sync->id || now - sync->leader_seen > CLOCKSYNC_LEADER_TIMEOUT_MS * 1000;
+}
+
+bool clocksync_check_leader(clocksync_t *sync, int64_t now) {
+    if (!clocksync_is_leader(sync, now)) return false;
+    sync->leader_id = sync->id;
+    return true;
+}
+
+bool clocksync_announce(clocksync_t *sync, uint64_t id, int64_t now) {
+    if (id == sync->leader_id) {
+        sync->leader_seen = now;
+        return true;
+    }
+    if (id > sync->id) return false;
+    if (id < sync->leader_id || clocksync_is_leader(sync, now)) {
+        printf("timesync: following %016llx\n", (unsigned long long) id);
+        sync->leader_id = id;
+        sync->leader_seen = now;
+        sync->sample_count = 0;
+        sync->sample_next = 0;
+        return true;
+    }
+    return false;
+}
+
+int64_t clocksync_response(clocksync_t *sync, const clocksync_packet_t *packet, int64_t t4) {
+    if (packet->id != sync->leader_id) return sync->offset;
+    clocksync_sample_t *sample = &sync->samples[sync->sample_next];
+    sample->offset = ((packet->t2 - packet->t1) + (packet->t3 - t4)) / 2;
+    sample->rtt = (t4 - packet->t1) - (packet->t3 - packet->t2);
+    sync->sample_next = (sync->sample_next + 1) % CLOCKSYNC_SAMPLES;
+    if (sync->sample_count < CLOCKSYNC_SAMPLES) sync->sample_count++;
+    sync->last_rtt = sample->rtt;
+    sync->responses++;
+
+    // the sample with the shortest round trip had the least queueing delay, so trust it most.
+    clocksync_sample_t *best = &sync->samples[0];
+    for (int i = 1; i < sync->sample_count; i++) if (sync->samples[i].rtt < best->rtt) best = &sync->samples[i];
+
+    int64_t diff = best->offset - sync->offset;
+    if (diff > CLOCKSYNC_STEP_THRESHOLD_US || diff < -CLOCKSYNC_STEP_THRESHOLD_US) {
+        sync->offset = best->offset;
+    } else {
+        sync->offset += diff / 4;
+    }
+    return sync->offset;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * the protocol half of timesync: picking the leader from announcements,
+ * and estimating our offset from its clock from request/response
+ * timestamps. timesync.c owns the socket and the task. this part is plain
+ * C with no ESP dependencies, so tools/timesync_sim.c can run a fleet of
+ * them over loopback on a host.
+ *
+ * times are all usec. "local" is this device's own clock, and "network"
+ * is local + offset.
+ */
+
+#define CLOCKSYNC_MAGIC 0x53544247  // "GBTS"
+#define CLOCKSYNC_ANNOUNCE_MS 1000
+#define CLOCKSYNC_POLL_MS 1000
+// poll faster until we have a full set of samples
+#define CLOCKSYNC_FAST_POLL_MS 100
+#define CLOCKSYNC_LEADER_TIMEOUT_MS 3500
+#define CLOCKSYNC_SAMPLES 8
+// if we're farther off than this, jump instead of slewing
+#define CLOCKSYNC_STEP_THRESHOLD_US 5000
+
+enum {
+    CLOCKSYNC_ANNOUNCE = 1,
+    CLOCKSYNC_REQUEST,
+    CLOCKSYNC_RESPONSE,
+};
+
+/*
+ * t1 is the requester's local clock when it sent the request, t2 & t3 are
+ * the responder's network time when it received the request and when it
+ * sent the response.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint64_t id;
+    int64_t t1, t2, t3;
+} clocksync_packet_t;
+
+typedef struct {
+    int64_t offset;
+    int64_t rtt;
+} clocksync_sample_t;
+
+typedef struct {
+    uint64_t id;
+    uint64_t leader_id;
+    // local time we last heard from the leader
+    int64_t leader_seen;
+    clocksync_sample_t samples[CLOCKSYNC_SAMPLES];
+    int sample_count;
+    int sample_next;
+    // network time - local time
+    int64_t offset;
+    int64_t last_rtt;
+    uint32_t responses;
+} clocksync_t;
+
+// start out leading ourselves, with no offset
+void clocksync_init(clocksync_t *sync, uint64_t id);
+
+// are we the leader? (either nobody lower is around, or the leader went quiet)
+bool clocksync_is_leader(const clocksync_t *sync, int64_t now);
+
+// take over if the leader went quiet. returns true if we're the leader.
+bool clocksync_check_leader(clocksync_t *sync, int64_t now);
+
+/*
+ * an announcement from `id` arrived at local time `now`. returns true if
+ * it came from the leader we're following (maybe as of just now), so the
+ * caller should send its requests to wherever it came from.
+ */
+bool clocksync_announce(clocksync_t *sync, uint64_t id, int64_t now);
+
+// a response arrived at local time `t4`. returns the new offset.
+int64_t clocksync_response(clocksync_t *sync, const clocksync_packet_t *packet, int64_t t4);
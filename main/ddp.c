@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "cli.h"
+#include "ddp.h"
+#include "source.h"
+#include "wifi.h"
+#include "ws2812b.h"
+
+#define HEADER_SIZE 10
+#define TIMECODE_SIZE 4
+#define FLAG_VERSION_MASK 0xc0
+#define FLAG_VERSION_1 0x40
+#define FLAG_TIMECODE 0x10
+#define FLAG_PUSH 0x01
+#define DEST_DEFAULT 1
+#define DEST_ALL 255
+
+// only touched by the receiver task
+static uint8_t s_packet[1500];
+static int s_extent = 0;
+static int s_last_sequence = 0;
+static bool s_gap = false;
+
+static uint32_t s_packets = 0;
+// frames dropped because a packet went missing, and packets that made no sense
+static uint32_t s_dropped = 0;
+static uint32_t s_rejected = 0;
+
+
+static void handle_packet(const uint8_t *packet, int len) {
+    s_packets++;
+    uint8_t flags = packet[0];
+    int header = HEADER_SIZE + ((flags & FLAG_TIMECODE) ? TIMECODE_SIZE : 0);
+    if (len < header || (flags & FLAG_VERSION_MASK) != FLAG_VERSION_1) {
+        s_rejected++;
+        return;
+    }
+    if (packet[3] != DEST_DEFAULT && packet[3] != DEST_ALL) return;
+
+    // sequence numbers run 1 - 15 (0 means the sender doesn't use them)
+    int sequence = packet[1] & 0x0f;
+    if (sequence != 0 && s_last_sequence != 0 && sequence != (s_last_sequence % 15) + 1) s_gap = true;
+    s_last_sequence = sequence;
+
+    uint32_t offset = (packet[4] << 24) | (packet[5] << 16) | (packet[6] << 8) | packet[7];
+    int length = (packet[8] << 8) | packet[9];
+    if (header + length > len) {
+        s_rejected++;
+        return;
+    }
+    if (offset < FRAMEBUF_SIZE) {
+        if (offset + length > FRAMEBUF_SIZE) length = FRAMEBUF_SIZE - offset;
+        memcpy(source_back(SOURCE_DDP) + offset, packet + header, length);
+        if (offset + length > s_extent) s_extent = offset + length;
+    }
+
+    if (flags & FLAG_PUSH) {
+        // a frame with a hole in it would flash whatever was in that buffer before, so skip it.
+        if (s_gap) {
+            s_dropped++;
+        } else if (s_extent > 0) {
+            source_publish(SOURCE_DDP, s_extent);
+        }
+        s_gap = false;
+        s_extent = 0;
+    }
+}
+
+static int open_socket(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) return -1;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(DDP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void ddp_task(void *arg) {
+    int sock = -1;
+    while (sock < 0) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (wifi_is_online()) sock = open_socket();
+    }
+
+    while (true) {
+        int len = recv(sock, s_packet, sizeof(s_packet), 0);
+        if (len <= 0) continue;
+        // keep the radio awake while frames are streaming in; dozing would hold each packet until the next beacon.
+        wifi_activity();
+        handle_packet(s_packet, len);
+    }
+}
+
+
+// ----- CLI
+
+static void cmd_ddp(const void *command_arg, int argc, const char * const *argv) {
+    const framebuf_t *frames = source_frames(SOURCE_DDP);
+    printf("ddp (udp port %d): %s\n", DDP_PORT, source_active() == SOURCE_DDP ? "live" : "idle");
+    printf("  packets %u, rejected %u\n", s_packets, s_rejected);
+    printf("  frames %u, dropped (incomplete) %u, overwritten %u, taken %u\n",
+        frames->published, s_dropped, frames->overwritten, frames->taken);
+    const framebuf_t *strip = ws2812b_frames();
+    printf("strip: frames %u, overwritten %u, sent %u\n", strip->published, strip->overwritten, strip->taken);
+}
+
+static cli_command_t commands[] = {
+    { "ddp", "show realtime (DDP) input stats", cmd_ddp, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+void ddp_init(void) {
+    TaskHandle_t task;
+    xTaskCreate(ddp_task, "ddp", DDP_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 4, &task);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * receive realtime pixel data over DDP (the "distributed display protocol"
+ * that xLights, WLED, and friends speak), so a PC can drive the strip
+ * directly. the receiver task assembles packets into whole frames and
+ * publishes them as SOURCE_DDP (see source.h), which shows in place of the
+ * effects for as long as frames keep coming. pixel data is raw RGB in
+ * strip order.
+ */
+
+#ifndef DDP_PORT
+#define DDP_PORT 4048
+#endif
+
+#ifndef DDP_TASK_STACK_SIZE
+#define DDP_TASK_STACK_SIZE 3072
+#endif
+
+// start the receiver task (it waits for wifi on its own) and register CLI commands.
+void ddp_init(void);
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include "esp_ota_ops.h"
+#include "mdns.h"
+
+#include "ddp.h"
+#include "discovery.h"
+#include "render.h"
+
+#define HTTP_PORT 80
+
+static bool s_started = false;
+
+
+static void set_txt(void) {
+    char leds[8], fps[8];
+    snprintf(leds, sizeof(leds), "%d", render_pixel_count());
+    snprintf(fps, sizeof(fps), "%d", 1000 / RENDER_FRAME_MS);
+
+    mdns_txt_item_t txt[] = {
+        { "leds", leds },
+        { "fps", fps },
+        { "protocols", "http,ddp" },
+        { "fw", esp_ota_get_app_description()->version },
+    };
+    mdns_service_txt_set("_glowball", "_tcp", txt, sizeof(txt) / sizeof(txt[0]));
+}
+
+void discovery_init(const char *name) {
+    ESP_ERROR_CHECK(mdns_init());
+    mdns_hostname_set(name);
+    mdns_instance_name_set(name);
+
+    mdns_txt_item_t http_txt[] = {
+        { "path", "/" },
+    };
+    mdns_service_add(NULL, "_http", "_tcp", HTTP_PORT, http_txt, 1);
+    mdns_service_add(NULL, "_glowball", "_tcp", HTTP_PORT, NULL, 0);
+    mdns_service_add(NULL, "_ddp", "_udp", DDP_PORT, NULL, 0);
+    s_started = true;
+    set_txt();
+}
+
+void discovery_set_name(const char *name) {
+    if (!s_started) return;
+    mdns_hostname_set(name);
+    mdns_instance_name_set(name);
+}
+
+void discovery_update(void) {
+    if (!s_started) return;
+    set_txt();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/*
+ * advertise ourselves over mDNS: our hostname, plus `_http._tcp`,
+ * `_ddp._udp`, and `_glowball._tcp` services with TXT records describing the
+ * strip, so a controller can find every glowball on the network without
+ * probing.
+ */
+void discovery_init(const char *name);
+
+// change the hostname (and instance name) in place.
+void discovery_set_name(const char *name);
+
+// refresh the TXT records after something they describe (like the LED count) changes.
+void discovery_update(void);
@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include "anim.h"
+#include "audio.h"
+#include "effect.h"
+#include "matrix.h"
+#include "vm.h"
+
+// first quarter of a sine wave, scaled to 0 - 127
+static const uint8_t SIN_QUARTER[65] = {
+    0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46, 49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83,
+    85, 88, 90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116, 117, 118, 120, 121, 122, 122,
+    123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127,
+};
+
+uint8_t effect_sin8(uint8_t theta) {
+    uint8_t q = theta & 63;
+    switch (theta >> 6) {
+        case 0: return 128 + SIN_QUARTER[q];
+        case 1: return 128 + SIN_QUARTER[64 - q];
+        case 2: return 128 - SIN_QUARTER[q];
+        default: return 128 - SIN_QUARTER[64 - q];
+    }
+}
+
+uint8_t effect_scale8(uint8_t n, uint8_t scale) {
+    return ((uint16_t) n * (1 + (uint16_t) scale)) >> 8;
+}
+
+uint32_t effect_hsv(uint8_t h, uint8_t s, uint8_t v) {
+    uint8_t region = h / 43;
+    uint8_t remainder = (h - region * 43) * 6;
+    uint8_t p = (v * (255 - s)) >> 8;
+    uint8_t q = (v * (255 - ((s * remainder) >> 8))) >> 8;
+    uint8_t t = (v * (255 - ((s * (255 - remainder)) >> 8))) >> 8;
+
+    switch (region) {
+        case 0: return (v << 16) | (t << 8) | p;
+        case 1: return (q << 16) | (v << 8) | p;
+        case 2: return (p << 16) | (v << 8) | t;
+        case 3: return (p << 16) | (q << 8) | v;
+        case 4: return (t << 16) | (p << 8) | v;
+        default: return (v << 16) | (p << 8) | q;
+    }
+}
+
+static inline void put_pixel(uint8_t *pixels, int i, uint32_t rgb) {
+    pixels[i * 3] = (rgb >> 16) & 0xff;
+    pixels[i * 3 + 1] = (rgb >> 8) & 0xff;
+    pixels[i * 3 + 2] = rgb & 0xff;
+}
+
+static uint32_t scale_color(uint32_t rgb, uint8_t scale) {
+    return (effect_scale8(rgb >> 16, scale) << 16) | (effect_scale8(rgb >> 8, scale) << 8) | effect_scale8(rgb, scale);
+}
+
+
+// ----- effects
+
+static void solid(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    for (int i = 0; i < count; i++) put_pixel(pixels, i, color);
+}
+
+// one full hue cycle across the run, drifting about once every 2 seconds
+static void rainbow(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    uint8_t offset = t >> 3;
+    for (int i = 0; i < count; i++) put_pixel(pixels, i, effect_hsv(offset + (i * 256) / count, 255, 255));
+}
+
+// fade the color in and out over about 4 seconds
+static void breathe(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    uint8_t level = effect_sin8(t >> 4);
+    solid(scale_color(color, effect_scale8(level, level)), t, pixels, count);
+}
+
+// every 4th pixel lit, marching at 10 pixels/sec
+static void chase(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    int phase = (t / 100) & 3;
+    for (int i = 0; i < count; i++) put_pixel(pixels, i, ((i & 3) == phase) ? color : 0);
+}
+
+// 2D: overlapping sine waves in x, y, and the diagonal, as hues. without a matrix, it's one row.
+static void plasma(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    int width = matrix_width();
+    if (width == 0 || width > count) width = count;
+    for (int y = 0, i = 0; i < count; y++) {
+        for (int x = 0; x < width && i < count; x++, i++) {
+            int v = effect_sin8(x * 16 + (t >> 3)) + effect_sin8(y * 16 + (t >> 4)) + effect_sin8((x + y) * 8 - (t >> 4));
+            put_pixel(pixels, i, effect_hsv(v / 3 + (t >> 6), 255, 255));
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    effect_callback_t callback;
+    bool animated;
+} EFFECTS[EFFECT_COUNT] = {
+    [EFFECT_SOLID] = { "solid", solid, false },
+    [EFFECT_RAINBOW] = { "rainbow", rainbow, true },
+    [EFFECT_BREATHE] = { "breathe", breathe, true },
+    [EFFECT_CHASE] = { "chase", chase, true },
+    [EFFECT_ANIM] = { "anim", anim_render, true },
+    [EFFECT_VM] = { "vm", vm_render, true },
+    [EFFECT_PLASMA] = { "plasma", plasma, true },
+    [EFFECT_AUDIO] = { "audio", audio_render, true },
+};
+
+int effect_find(const char *name) {
+    for (int i = 0; i < EFFECT_COUNT; i++) {
+        if (strcmp(name, EFFECTS[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+const char *effect_name(int effect) {
+    if (effect < 0 || effect >= EFFECT_COUNT) return "?";
+    return EFFECTS[effect].name;
+}
+
+bool effect_is_animated(int effect) {
+    if (effect < 0 || effect >= EFFECT_COUNT) return false;
+    return EFFECTS[effect].animated;
+}
+
+void effect_render(int effect, uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    if (effect < 0 || effect >= EFFECT_COUNT) effect = EFFECT_SOLID;
+    EFFECTS[effect].callback(color, t, pixels, count);
+}
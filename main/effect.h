@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * effects fill a run of pixels (packed RGB, 3 bytes each) for a point in
+ * time `t` (msec). `color` is the owning segment's color, which some effects
+ * ignore.
+ */
+typedef void (*effect_callback_t)(uint32_t color, uint32_t t, uint8_t *pixels, int count);
+
+typedef enum {
+    EFFECT_SOLID = 0,
+    EFFECT_RAINBOW,
+    EFFECT_BREATHE,
+    EFFECT_CHASE,
+    // plays back the stored animation (see anim.h)
+    EFFECT_ANIM,
+    // runs the uploaded effect program (see vm.h)
+    EFFECT_VM,
+    // 2D, laid out by the matrix map (see matrix.h)
+    EFFECT_PLASMA,
+    // spectrum from the microphone (see audio.h)
+    EFFECT_AUDIO,
+    EFFECT_COUNT,
+} effect_t;
+
+// returns -1 if there's no effect by that name
+int effect_find(const char *name);
+const char *effect_name(int effect);
+
+// does this effect change over time? (if not, the render task can skip frames)
+bool effect_is_animated(int effect);
+
+void effect_render(int effect, uint32_t color, uint32_t t, uint8_t *pixels, int count);
+
+// integer helpers for effects: sin scaled to 0 - 255, scale by n/256, and hsv -> 0xRRGGBB.
+uint8_t effect_sin8(uint8_t theta);
+uint8_t effect_scale8(uint8_t n, uint8_t scale);
+uint32_t effect_hsv(uint8_t h, uint8_t s, uint8_t v);
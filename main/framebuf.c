@@ -0,0 +1,34 @@
+#include <string.h>
+
+#include "framebuf.h"
+
+void framebuf_init(framebuf_t *framebuf) {
+    memset(framebuf, 0, sizeof(*framebuf));
+    framebuf->back = 0;
+    framebuf->middle = 1;
+    framebuf->front = 2;
+}
+
+uint8_t *framebuf_back(framebuf_t *framebuf) {
+    return framebuf->buffers[framebuf->back];
+}
+
+void framebuf_publish(framebuf_t *framebuf, int size) {
+    if (size > FRAMEBUF_SIZE) size = FRAMEBUF_SIZE;
+    framebuf->sizes[framebuf->back] = size;
+    // release: the consumer has to see the frame's contents before it sees the new index.
+    uint32_t old = __atomic_exchange_n(&framebuf->middle, framebuf->back | FRAMEBUF_FRESH, __ATOMIC_ACQ_REL);
+    framebuf->back = old & 0xff;
+    framebuf->published++;
+    if (old & FRAMEBUF_FRESH) framebuf->overwritten++;
+}
+
+const uint8_t *framebuf_take(framebuf_t *framebuf, int *size) {
+    if (!(__atomic_load_n(&framebuf->middle, __ATOMIC_RELAXED) & FRAMEBUF_FRESH)) return NULL;
+    // acquire: pairs with the release in `framebuf_publish`.
+    uint32_t old = __atomic_exchange_n(&framebuf->middle, framebuf->front, __ATOMIC_ACQ_REL);
+    framebuf->front = old & 0xff;
+    framebuf->taken++;
+    if (size != NULL) *size = framebuf->sizes[framebuf->front];
+    return framebuf->buffers[framebuf->front];
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * a triple buffer for handing whole frames from one task (the producer) to
+ * another (the consumer) without locks or tearing. the producer owns one
+ * buffer and the consumer another; the third sits in the middle holding the
+ * newest finished frame, and each side swaps with it in one atomic
+ * exchange. neither side ever waits: if the producer is faster, the frame
+ * in the middle gets replaced (and counted as overwritten), and the
+ * consumer always gets the newest one.
+ *
+ * exactly one task may call the producer functions, and exactly one the
+ * consumer function. it's plain C with no ESP dependencies, so
+ * tools/framebuf_stress.c can hammer it on a host.
+ */
+
+#ifndef FRAMEBUF_SIZE
+#define FRAMEBUF_SIZE (300 * 3)
+#endif
+
+typedef struct {
+    uint8_t buffers[3][FRAMEBUF_SIZE];
+    // bytes used in each buffer
+    uint16_t sizes[3];
+    // index of the middle buffer, plus FRAMEBUF_FRESH if the consumer hasn't taken it
+    uint32_t middle;
+    // owned by the producer
+    uint8_t back;
+    // owned by the consumer
+    uint8_t front;
+
+    // frames published, and how many of those were replaced before the consumer took them
+    uint32_t published;
+    uint32_t overwritten;
+    // frames the consumer took
+    uint32_t taken;
+} framebuf_t;
+
+#define FRAMEBUF_FRESH 0x100
+
+void framebuf_init(framebuf_t *framebuf);
+
+// producer: the buffer to fill. it stays the same until the next `framebuf_publish`.
+uint8_t *framebuf_back(framebuf_t *framebuf);
+
+// producer: hand over the back buffer (the first `size` bytes of it), and get a new one.
+void framebuf_publish(framebuf_t *framebuf, int size);
+
+/*
+ * consumer: take the newest frame, if one has been published since the last
+ * call. otherwise returns NULL. the frame stays valid (and unchanged) until
+ * the next call that returns non-NULL.
+ */
+const uint8_t *framebuf_take(framebuf_t *framebuf, int *size);
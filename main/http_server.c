@@ -1,6 +1,29 @@
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "anim.h"
+#include "cli.h"
+#include "effect.h"
+#include "esp_ota_ops.h"
 #include "http_server.h"
-#include "ws2812b.h"
+#include "macro.h"
+#include "matrix.h"
+#include "ota.h"
+#include "perf.h"
+#include "pool.h"
+#include "preset.h"
+#include "profiler.h"
+#include "render.h"
+#include "settings.h"
+#include "source.h"
+#include "trace.h"
+#include "vm.h"
+#include "wifi.h"
+
+// request bodies and upload chunks come from the block pool
+_Static_assert(POOL_BLOCK_SIZE >= HTTP_MAX_SCRIPT_SIZE && POOL_BLOCK_SIZE >= HTTP_OTA_CHUNK_SIZE, "POOL_BLOCK_SIZE is too small");
+_Static_assert(POOL_BLOCK_SIZE >= sizeof(vm_header_t) + VM_MAX_CODE, "POOL_BLOCK_SIZE is too small");
 
 static uint32_t hex_to_color(const char *hex) {
     uint32_t rv = 0;
@@ -23,40 +46,176 @@ static void bad_request(httpd_req_t *req, const char *reason) {
     httpd_resp_send(req, reason, HTTPD_RESP_USE_STRLEN);
 }
 
-// GET /set?color=RRGGBB
+static bool query_int(const char *query, const char *key, int *value) {
+    char buffer[8];
+    if (httpd_query_key_value(query, key, buffer, sizeof(buffer)) != ESP_OK) return false;
+    *value = atoi(buffer);
+    return true;
+}
+
+static bool query_color(const char *query, uint32_t *color) {
+    char hex[8];
+    if (httpd_query_key_value(query, "color", hex, sizeof(hex)) != ESP_OK || strlen(hex) != 6) return false;
+    *color = hex_to_color(hex);
+    return true;
+}
+
+static bool query_effect(const char *query, uint8_t *effect) {
+    char name[16];
+    if (httpd_query_key_value(query, "effect", name, sizeof(name)) != ESP_OK) return false;
+    int e = effect_find(name);
+    if (e < 0) return false;
+    *effect = e;
+    return true;
+}
+
+// if there's an `ms` param, start a transition of that length before making a change.
+static void query_transition(const char *query) {
+    int ms;
+    if (query_int(query, "ms", &ms) && ms > 0) render_transition(ms);
+}
+
+// GET /set?color=RRGGBB[&effect=name][&segment=name][&count=N][&ms=N]
 static esp_err_t set_handler(httpd_req_t *req) {
-    char query[40];
+    wifi_activity();
+    char query[128];
     esp_err_t err = httpd_req_get_url_query_str(req, query, sizeof(query));
     if (err != ESP_OK) {
         bad_request(req, "query string too long or fucked up");
         return ESP_OK;
     }
 
-    char hex[8];
-    err = httpd_query_key_value(query, "color", hex, sizeof(hex));
-    if (err != ESP_OK) {
-        bad_request(req, "missing or fucked up 'color' param");
+    char name[SEGMENT_NAME_SIZE];
+    if (httpd_query_key_value(query, "segment", name, sizeof(name)) != ESP_OK) strcpy(name, "all");
+    segment_t segment;
+    if (!render_segment_get(name, &segment)) {
+        bad_request(req, "no such segment");
         return ESP_OK;
     }
 
-    if (strlen(hex) != 6) {
-        bad_request(req, "color must be exactly 6 chars");
+    bool has_color = query_color(query, &segment.color);
+    bool has_effect = query_effect(query, &segment.effect);
+    if (!has_color && !has_effect) {
+        bad_request(req, "missing or fucked up 'color' (RRGGBB) or 'effect' param");
         return ESP_OK;
     }
 
-    int count = 16;
-    char count_str[8];
-    if (httpd_query_key_value(query, "count", count_str, sizeof(count_str)) == ESP_OK) {
-        count = atoi(count_str);
-    }
+    // old clients use `count` to light the first N pixels
+    int count;
+    if (query_int(query, "count", &count)) segment.length = count;
 
-    ws2812b_set(hex_to_color(hex), count);
+    query_transition(query);
+    const char *error = render_segment_put(&segment);
+    if (error != NULL) {
+        bad_request(req, error);
+        return ESP_OK;
+    }
     httpd_resp_set_status(req, "303 See Other");
     httpd_resp_set_hdr(req, "Location", "/");
     httpd_resp_send(req, "", 0);
     return ESP_OK;
 }
 
+// GET /segment?name=x[&start=N][&length=N][&reverse=0|1][&mirror=0|1][&effect=name][&color=RRGGBB][&delete=1][&ms=N]
+static esp_err_t segment_handler(httpd_req_t *req) {
+    wifi_activity();
+    char query[160];
+    char name[SEGMENT_NAME_SIZE];
+    if (
+        httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "name", name, sizeof(name)) != ESP_OK
+    ) {
+        bad_request(req, "missing or fucked up 'name' param");
+        return ESP_OK;
+    }
+
+    int value;
+    if (query_int(query, "delete", &value) && value) {
+        query_transition(query);
+        if (!render_segment_remove(name)) {
+            bad_request(req, "no such segment");
+        } else {
+            httpd_resp_sendstr(req, "ok");
+        }
+        return ESP_OK;
+    }
+
+    segment_t segment;
+    if (!render_segment_get(name, &segment)) {
+        memset(&segment, 0, sizeof(segment));
+        strcpy(segment.name, name);
+    }
+    if (query_int(query, "start", &value)) segment.start = value;
+    if (query_int(query, "length", &value)) segment.length = value;
+    if (query_int(query, "reverse", &value)) {
+        segment.flags = value ? (segment.flags | SEGMENT_REVERSE) : (segment.flags & ~SEGMENT_REVERSE);
+    }
+    if (query_int(query, "mirror", &value)) {
+        segment.flags = value ? (segment.flags | SEGMENT_MIRROR) : (segment.flags & ~SEGMENT_MIRROR);
+    }
+    query_color(query, &segment.color);
+    query_effect(query, &segment.effect);
+
+    query_transition(query);
+    const char *error = render_segment_put(&segment);
+    if (error != NULL) {
+        bad_request(req, error);
+        return ESP_OK;
+    }
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
+// GET /preset?id=N[&save=1][&delete=1][&ms=N] -- recall by default
+static esp_err_t preset_handler(httpd_req_t *req) {
+    wifi_activity();
+    char query[64];
+    int id, value;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK || !query_int(query, "id", &id)) {
+        bad_request(req, "missing or fucked up 'id' param");
+        return ESP_OK;
+    }
+
+    bool ok;
+    if (query_int(query, "save", &value) && value) {
+        ok = preset_save(id);
+    } else if (query_int(query, "delete", &value) && value) {
+        ok = preset_erase(id);
+    } else {
+        ok = preset_recall(id, query_int(query, "ms", &value) ? value : 0);
+    }
+
+    if (!ok) {
+        bad_request(req, "no such preset");
+        return ESP_OK;
+    }
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
+// GET /segments -> json list
+static esp_err_t segments_handler(httpd_req_t *req) {
+    segment_t segments[RENDER_MAX_SEGMENTS];
+    int count = render_segment_list(segments, RENDER_MAX_SEGMENTS);
+    char line[160], hex[8];
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, "[");
+    for (int i = 0; i < count; i++) {
+        segment_t *s = &segments[i];
+        color_to_hex(s->color, hex);
+        snprintf(line, sizeof(line),
+            "%s{\"name\":\"%s\",\"start\":%d,\"length\":%d,\"reverse\":%s,\"mirror\":%s,\"effect\":\"%s\",\"color\":\"%s\"}",
+            i == 0 ? "" : ",", s->name, s->start, s->length,
+            (s->flags & SEGMENT_REVERSE) ? "true" : "false", (s->flags & SEGMENT_MIRROR) ? "true" : "false",
+            effect_name(s->effect), hex);
+        httpd_resp_sendstr_chunk(req, line);
+    }
+    httpd_resp_sendstr_chunk(req, "]");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
 static httpd_uri_t get_set_uri = {
     .uri      = "/set",
     .method   = HTTP_GET,
@@ -71,6 +230,410 @@ static httpd_uri_t post_set_uri = {
     .user_ctx = NULL,
 };
 
+static httpd_uri_t segment_uri = {
+    .uri      = "/segment",
+    .method   = HTTP_GET,
+    .handler  = segment_handler,
+    .user_ctx = NULL,
+};
+
+static httpd_uri_t preset_uri = {
+    .uri      = "/preset",
+    .method   = HTTP_GET,
+    .handler  = preset_handler,
+    .user_ctx = NULL,
+};
+
+static httpd_uri_t segments_uri = {
+    .uri      = "/segments",
+    .method   = HTTP_GET,
+    .handler  = segments_handler,
+    .user_ctx = NULL,
+};
+
+
+static void write_chunk(void *context, const char *text) {
+    httpd_resp_sendstr_chunk((httpd_req_t *) context, text);
+}
+
+// GET /metrics -> prometheus text format
+static esp_err_t metrics_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    perf_write_metrics(write_chunk, req);
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+static httpd_uri_t metrics_uri = {
+    .uri      = "/metrics",
+    .method   = HTTP_GET,
+    .handler  = metrics_handler,
+    .user_ctx = NULL,
+};
+
+// GET /tasks -> json array of tasks, with CPU use over the last 1/10/60 seconds
+static esp_err_t tasks_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "application/json");
+    profiler_write_json(write_chunk, req);
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+static httpd_uri_t tasks_uri = {
+    .uri      = "/tasks",
+    .method   = HTTP_GET,
+    .handler  = tasks_handler,
+    .user_ctx = NULL,
+};
+
+// GET /trace -> the event ring as Chrome trace JSON (open it in chrome://tracing or ui.perfetto.dev)
+static esp_err_t trace_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"glowball-trace.json\"");
+    trace_write_json(write_chunk, req);
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+static httpd_uri_t trace_uri = {
+    .uri      = "/trace",
+    .method   = HTTP_GET,
+    .handler  = trace_handler,
+    .user_ctx = NULL,
+};
+
+static void write_output(void *context, const char *data, size_t len) {
+    httpd_resp_send_chunk((httpd_req_t *) context, data, len);
+}
+
+// POST /cli[?save=name] -- run the body as a CLI script (or save it as a macro), and stream back the output
+static esp_err_t cli_handler(httpd_req_t *req) {
+    wifi_activity();
+    if (req->content_len >= HTTP_MAX_SCRIPT_SIZE) {
+        bad_request(req, "script too big");
+        return ESP_OK;
+    }
+    char *script = pool_alloc(req->content_len + 1);
+    if (script == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    size_t len = 0;
+    while (len < req->content_len) {
+        int n = httpd_req_recv(req, script + len, req->content_len - len);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0) {
+            pool_free(script);
+            return ESP_FAIL;
+        }
+        len += n;
+    }
+    script[len] = 0;
+
+    // (room for a name that's too long, so macro_save can say so)
+    char query[32], name[16];
+    if (
+        httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "save", name, sizeof(name)) == ESP_OK
+    ) {
+        const char *error = macro_save(name, script);
+        if (error == NULL) {
+            httpd_resp_sendstr(req, "ok");
+        } else {
+            bad_request(req, error);
+        }
+        pool_free(script);
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "text/plain");
+    cli_run_script(script, write_output, req);
+    httpd_resp_send_chunk(req, NULL, 0);
+    pool_free(script);
+    return ESP_OK;
+}
+
+static httpd_uri_t cli_uri = {
+    .uri      = "/cli",
+    .method   = HTTP_POST,
+    .handler  = cli_handler,
+    .user_ctx = NULL,
+};
+
+// decode %xx and '+' in place
+static void url_decode(char *s) {
+    char *out = s;
+    while (*s) {
+        if (*s == '%' && isxdigit((int) s[1]) && isxdigit((int) s[2])) {
+            char hex[3] = { s[1], s[2], 0 };
+            *out++ = strtol(hex, NULL, 16);
+            s += 3;
+        } else {
+            *out++ = (*s == '+') ? ' ' : *s;
+            s++;
+        }
+    }
+    *out = 0;
+}
+
+// GET /config -> json object of all settings
+static esp_err_t config_get_handler(httpd_req_t *req) {
+    httpd_resp_set_type(req, "application/json");
+    settings_write_json(write_chunk, req);
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+// POST /config?key=value[&key=value...] -- change any settings given, then reply like GET
+static esp_err_t config_post_handler(httpd_req_t *req) {
+    wifi_activity();
+    char query[256];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+        bad_request(req, "query string too long or fucked up");
+        return ESP_OK;
+    }
+
+    // stop at the first bad value, and name it in the reply.
+    char value[SETTINGS_STR_SIZE * 3];
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        if (httpd_query_key_value(query, settings_key(i), value, sizeof(value)) != ESP_OK) continue;
+        url_decode(value);
+        if (!settings_set(i, value)) {
+            bad_request(req, settings_key(i));
+            return ESP_OK;
+        }
+    }
+    return config_get_handler(req);
+}
+
+static httpd_uri_t config_get_uri = {
+    .uri      = "/config",
+    .method   = HTTP_GET,
+    .handler  = config_get_handler,
+    .user_ctx = NULL,
+};
+
+static httpd_uri_t config_post_uri = {
+    .uri      = "/config",
+    .method   = HTTP_POST,
+    .handler  = config_post_handler,
+    .user_ctx = NULL,
+};
+
+// POST /ota -- body is a firmware image (the .bin), streamed straight into the spare app partition
+static esp_err_t ota_handler(httpd_req_t *req) {
+    wifi_activity();
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL) {
+        bad_request(req, "no ota partition");
+        return ESP_OK;
+    }
+    // the app descriptor (with the project name) comes right after the first segment header.
+    const size_t desc_offset = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t);
+    const size_t header_size = desc_offset + sizeof(esp_app_desc_t);
+    if (req->content_len < header_size || req->content_len > partition->size) {
+        bad_request(req, "image is missing, too small, or too big");
+        return ESP_OK;
+    }
+
+    char *chunk = pool_alloc(HTTP_OTA_CHUNK_SIZE);
+    if (chunk == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    // erase each sector as the write reaches it, rather than the whole image up front, which would
+    // stall this handler (and the connection) for seconds before the first byte is read.
+    esp_ota_handle_t ota;
+    if (esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &ota) != ESP_OK) {
+        pool_free(chunk);
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    printf("ota: receiving %u bytes into %s\n", req->content_len, partition->label);
+    int64_t start = perf_now();
+    // bytes waiting in `chunk`
+    size_t received = 0, filled = 0;
+    bool checked = false;
+    const char *error = NULL;
+    while (received < req->content_len && error == NULL) {
+        size_t want = req->content_len - received;
+        if (want > HTTP_OTA_CHUNK_SIZE - filled) want = HTTP_OTA_CHUNK_SIZE - filled;
+        int n = httpd_req_recv(req, chunk + filled, want);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0) {
+            error = "connection dropped";
+            break;
+        }
+        filled += n;
+        received += n;
+
+        // refuse something that isn't a glowball image before writing any of it. reads can be short,
+        // so keep the start of the image until the whole descriptor is here.
+        if (!checked) {
+            if (filled < header_size) continue;
+            const esp_app_desc_t *desc = (const esp_app_desc_t *) (chunk + desc_offset);
+            if (strncmp(desc->project_name, esp_ota_get_app_description()->project_name, sizeof(desc->project_name)) != 0) {
+                error = "not a glowball image";
+                break;
+            }
+            checked = true;
+        }
+
+        if (esp_ota_write(ota, chunk, filled) != ESP_OK) error = "write failed";
+        filled = 0;
+        wifi_activity();
+    }
+    pool_free(chunk);
+
+    if (error != NULL) {
+        esp_ota_abort(ota);
+        bad_request(req, error);
+        return ESP_OK;
+    }
+    // checks the image's hash.
+    if (esp_ota_end(ota) != ESP_OK) {
+        bad_request(req, "image is corrupt");
+        return ESP_OK;
+    }
+    if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+
+    printf("ota: wrote %u bytes in %lld ms, rebooting\n", received, (perf_now() - start) / 1000);
+    httpd_resp_sendstr(req, "ok, rebooting");
+    ota_restart(500);
+    return ESP_OK;
+}
+
+static httpd_uri_t ota_uri = {
+    .uri      = "/ota",
+    .method   = HTTP_POST,
+    .handler  = ota_handler,
+    .user_ctx = NULL,
+};
+
+// POST /anim -- body is an animation from tools/anim_encode.py, streamed into the anim partition
+static esp_err_t anim_handler(httpd_req_t *req) {
+    wifi_activity();
+    if (req->content_len == 0 || !anim_upload_begin(req->content_len)) {
+        bad_request(req, "animation is missing or too big");
+        return ESP_OK;
+    }
+
+    char *chunk = pool_alloc(HTTP_OTA_CHUNK_SIZE);
+    if (chunk == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        size_t want = req->content_len - received;
+        int n = httpd_req_recv(req, chunk, want < HTTP_OTA_CHUNK_SIZE ? want : HTTP_OTA_CHUNK_SIZE);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0 || !anim_upload_write(chunk, n)) break;
+        received += n;
+        wifi_activity();
+    }
+    pool_free(chunk);
+
+    if (received < req->content_len || !anim_upload_end()) {
+        bad_request(req, "upload failed or animation is corrupt");
+        return ESP_OK;
+    }
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
+static httpd_uri_t anim_uri = {
+    .uri      = "/anim",
+    .method   = HTTP_POST,
+    .handler  = anim_handler,
+    .user_ctx = NULL,
+};
+
+// POST /vm -- body is an effect program from tools/vm_asm.py
+static esp_err_t vm_handler(httpd_req_t *req) {
+    wifi_activity();
+    if (req->content_len == 0 || req->content_len > sizeof(vm_header_t) + VM_MAX_CODE) {
+        bad_request(req, "program is missing or too big");
+        return ESP_OK;
+    }
+    uint8_t *program = pool_alloc(req->content_len);
+    if (program == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    size_t len = 0;
+    while (len < req->content_len) {
+        int n = httpd_req_recv(req, (char *) program + len, req->content_len - len);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0) {
+            pool_free(program);
+            return ESP_FAIL;
+        }
+        len += n;
+    }
+
+    const char *error = vm_load(program, len);
+    pool_free(program);
+    if (error != NULL) {
+        bad_request(req, error);
+        return ESP_OK;
+    }
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
+static httpd_uri_t vm_uri = {
+    .uri      = "/vm",
+    .method   = HTTP_POST,
+    .handler  = vm_handler,
+    .user_ctx = NULL,
+};
+
+// POST /matrix -- body is the custom layout's table (see `matrix_set_table`)
+static esp_err_t matrix_handler(httpd_req_t *req) {
+    wifi_activity();
+    if (req->content_len >= HTTP_MAX_SCRIPT_SIZE) {
+        bad_request(req, "table too big");
+        return ESP_OK;
+    }
+    char *text = pool_alloc(req->content_len + 1);
+    if (text == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_OK;
+    }
+    size_t len = 0;
+    while (len < req->content_len) {
+        int n = httpd_req_recv(req, text + len, req->content_len - len);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0) {
+            pool_free(text);
+            return ESP_FAIL;
+        }
+        len += n;
+    }
+    text[len] = 0;
+
+    const char *error = matrix_set_table(text);
+    pool_free(text);
+    if (error != NULL) {
+        bad_request(req, error);
+        return ESP_OK;
+    }
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
+static httpd_uri_t matrix_uri = {
+    .uri      = "/matrix",
+    .method   = HTTP_POST,
+    .handler  = matrix_handler,
+    .user_ctx = NULL,
+};
 
 static esp_err_t handler(httpd_req_t *req) {
     /* Send a simple response */
@@ -86,14 +649,80 @@ static httpd_uri_t uri_get = {
     .user_ctx = NULL
 };
 
+// POST /frame -- body is one frame of packed RGB in strip order, shown over the effects (see source.h). empty lets go.
+static esp_err_t frame_handler(httpd_req_t *req) {
+    wifi_activity();
+    if (req->content_len == 0) {
+        source_release(SOURCE_HTTP);
+        httpd_resp_sendstr(req, "ok");
+        return ESP_OK;
+    }
+    if (req->content_len > RENDER_MAX_PIXELS * 3) {
+        bad_request(req, "frame too big");
+        return ESP_OK;
+    }
+    // the server handles one request at a time, so this is the only producer.
+    uint8_t *back = source_back(SOURCE_HTTP);
+    size_t len = 0;
+    while (len < req->content_len) {
+        int n = httpd_req_recv(req, (char *) back + len, req->content_len - len);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (n <= 0) return ESP_FAIL;
+        len += n;
+    }
+    source_publish(SOURCE_HTTP, len - len % 3);
+    httpd_resp_sendstr(req, "ok");
+    return ESP_OK;
+}
+
+static httpd_uri_t frame_uri = {
+    .uri      = "/frame",
+    .method   = HTTP_POST,
+    .handler  = frame_handler,
+    .user_ctx = NULL,
+};
+
+// each handler runs inside a trace span named for its uri. `user_ctx` is the original httpd_uri_t.
+static esp_err_t traced_handler(httpd_req_t *req) {
+    const httpd_uri_t *uri = req->user_ctx;
+    trace_begin(uri->uri);
+    esp_err_t rv = uri->handler(req);
+    trace_end(uri->uri);
+    return rv;
+}
+
+static void register_uri(httpd_handle_t server, const httpd_uri_t *uri) {
+    httpd_uri_t traced = *uri;
+    traced.handler = traced_handler;
+    traced.user_ctx = (void *) uri;
+    httpd_register_uri_handler(server, &traced);
+}
+
 httpd_handle_t http_server_start(void) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = 20;
+    // CLI scripts run on the server task
+    config.stack_size = HTTP_SERVER_STACK_SIZE;
     httpd_handle_t server = NULL;
     ESP_ERROR_CHECK(httpd_start(&server, &config));
 
-    httpd_register_uri_handler(server, &uri_get);
-    httpd_register_uri_handler(server, &get_set_uri);
-    httpd_register_uri_handler(server, &post_set_uri);
+    register_uri(server, &uri_get);
+    register_uri(server, &get_set_uri);
+    register_uri(server, &post_set_uri);
+    register_uri(server, &segment_uri);
+    register_uri(server, &segments_uri);
+    register_uri(server, &preset_uri);
+    register_uri(server, &metrics_uri);
+    register_uri(server, &tasks_uri);
+    register_uri(server, &trace_uri);
+    register_uri(server, &cli_uri);
+    register_uri(server, &config_get_uri);
+    register_uri(server, &config_post_uri);
+    register_uri(server, &ota_uri);
+    register_uri(server, &anim_uri);
+    register_uri(server, &vm_uri);
+    register_uri(server, &matrix_uri);
+    register_uri(server, &frame_uri);
 
     return server;
 }
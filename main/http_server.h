@@ -2,4 +2,19 @@
 
 #include "esp_http_server.h"
 
+// POST /cli runs scripts on the server's task, so it needs more than the default 4KB
+#ifndef HTTP_SERVER_STACK_SIZE
+#define HTTP_SERVER_STACK_SIZE 6144
+#endif
+
+// biggest script accepted by POST /cli (and table by POST /matrix)
+#ifndef HTTP_MAX_SCRIPT_SIZE
+#define HTTP_MAX_SCRIPT_SIZE 4096
+#endif
+
+// POST /ota and /anim read the body in chunks this big
+#ifndef HTTP_OTA_CHUNK_SIZE
+#define HTTP_OTA_CHUNK_SIZE 4096
+#endif
+
 httpd_handle_t http_server_start(void);
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "macro.h"
+#include "pool.h"
+
+_Static_assert(POOL_BLOCK_SIZE >= MACRO_MAX_SIZE, "POOL_BLOCK_SIZE is too small");
+
+#define KEY_PREFIX "macro-"
+
+static nvs_handle_t s_nvs_handle;
+
+
+static bool macro_key(const char *name, char *key) {
+    if (strlen(name) >= MACRO_NAME_SIZE) return false;
+    snprintf(key, 16, KEY_PREFIX "%s", name);
+    return true;
+}
+
+// returns a copy of the script in a pool block, or NULL
+static char *load(const char *name) {
+    char key[16];
+    size_t len;
+    if (!macro_key(name, key) || nvs_get_str(s_nvs_handle, key, NULL, &len) != ESP_OK) return NULL;
+    char *script = pool_alloc(len);
+    if (script == NULL) return NULL;
+    if (nvs_get_str(s_nvs_handle, key, script, &len) != ESP_OK) {
+        pool_free(script);
+        return NULL;
+    }
+    return script;
+}
+
+
+// ----- API
+
+const char *macro_save(const char *name, const char *script) {
+    char key[16];
+    if (!macro_key(name, key)) return "name too long";
+    if (strlen(script) >= MACRO_MAX_SIZE) return "script too long";
+    // (usually ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+    esp_err_t err = nvs_set_str(s_nvs_handle, key, script);
+    if (err != ESP_OK) return esp_err_to_name(err);
+    nvs_commit(s_nvs_handle);
+    return NULL;
+}
+
+bool macro_erase(const char *name) {
+    char key[16];
+    if (!macro_key(name, key) || nvs_erase_key(s_nvs_handle, key) != ESP_OK) return false;
+    nvs_commit(s_nvs_handle);
+    return true;
+}
+
+bool macro_run(const char *name, cli_output_t output, void *context) {
+    char *script = load(name);
+    if (script == NULL) return false;
+    cli_run_script(script, output, context);
+    pool_free(script);
+    return true;
+}
+
+
+// ----- CLI
+
+static void cmd_macro_list(const void *command_arg, int argc, const char * const *argv) {
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, "glowball", NVS_TYPE_STR);
+    while (it != NULL) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        if (strncmp(info.key, KEY_PREFIX, strlen(KEY_PREFIX)) == 0) printf("%s\n", info.key + strlen(KEY_PREFIX));
+        it = nvs_entry_next(it);
+    }
+}
+
+static void cmd_macro_show(const void *command_arg, int argc, const char * const *argv) {
+    char *script = argc < 2 ? NULL : load(argv[1]);
+    if (script == NULL) {
+        printf("no such macro\n");
+        return;
+    }
+    printf("%s\n", script);
+    pool_free(script);
+}
+
+static void cmd_macro_set(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 3) {
+        printf("usage: macro set <name> <commands; ...>\n");
+        return;
+    }
+    // glue the commands back together (the last arg already has whatever didn't fit in argv).
+    char script[CLI_BUFFER_SIZE];
+    script[0] = 0;
+    for (int i = 2; i < argc; i++) {
+        if (i > 2) strlcat(script, " ", sizeof(script));
+        strlcat(script, argv[i], sizeof(script));
+    }
+    const char *error = macro_save(argv[1], script);
+    if (error != NULL) printf("%s\n", error);
+}
+
+static void cmd_macro_run(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2 || !macro_run(argv[1], NULL, NULL)) printf("no such macro\n");
+}
+
+static void cmd_macro_del(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2 || !macro_erase(argv[1])) printf("no such macro\n");
+}
+
+static cli_command_t macro_commands[] = {
+    { "list", "show saved macros", cmd_macro_list, NULL, NULL },
+    { "show <name>", "show a macro's commands", cmd_macro_show, NULL, NULL },
+    { "set <name> <commands; ...>", "save a macro (\"boot\" runs at startup)", cmd_macro_set, NULL, NULL },
+    { "run <name>", "run a macro", cmd_macro_run, NULL, NULL },
+    { "del <name>", "erase a macro", cmd_macro_del, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "macro", NULL, NULL, NULL, macro_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void macro_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    cli_register_commands(commands);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include "cli.h"
+#include "nvs_flash.h"
+
+/*
+ * a macro is a named CLI script (commands separated by ';' or newlines),
+ * stored in NVS as "macro-<name>". the one named "boot" is run once at
+ * startup, after networking is up.
+ */
+
+// names have to fit in an NVS key after "macro-"
+#define MACRO_NAME_SIZE 10
+
+#ifndef MACRO_MAX_SIZE
+#define MACRO_MAX_SIZE 1024
+#endif
+
+// register CLI commands
+void macro_init(nvs_handle_t nvs_handle);
+
+// store (or replace) a macro. returns NULL, or what went wrong.
+const char *macro_save(const char *name, const char *script);
+
+bool macro_erase(const char *name);
+
+// run a macro with `cli_run_script`. returns false if there's no such macro.
+bool macro_run(const char *name, cli_output_t output, void *context);
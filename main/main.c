@@ -7,12 +7,28 @@
 #include "esp_system.h"
 #include "esp_spi_flash.h"
 #include "nvs_flash.h"
-#include "mdns.h"
 
 #include "driver/gpio.h"
 
+#include "anim.h"
+#include "audio.h"
 #include "cli.h"
+#include "ddp.h"
+#include "discovery.h"
 #include "http_server.h"
+#include "macro.h"
+#include "matrix.h"
+#include "ota.h"
+#include "perf.h"
+#include "pool.h"
+#include "preset.h"
+#include "profiler.h"
+#include "render.h"
+#include "settings.h"
+#include "source.h"
+#include "timesync.h"
+#include "trace.h"
+#include "vm.h"
 #include "wifi.h"
 #include "ws2812b.h"
 
@@ -20,6 +36,9 @@ nvs_handle_t s_nvs_handle;
 
 #define THING_GPIO_LED 5
 #define NEOPIXEL_GPIO 13
+#define NET_TASK_STACK_SIZE 4096
+// telnet to this port for a CLI session
+#define CLI_TCP_PORT 23
 
 
 static void cmd_mem(const void *command_arg, int argc, const char * const *argv) {
@@ -30,30 +49,10 @@ static void cmd_mem(const void *command_arg, int argc, const char * const *argv)
 
     printf("heap: %u/%u free, low %u, largest %u\n",
         heap_info.total_free_bytes, total, xPortGetMinimumEverFreeHeapSize(), heap_info.largest_free_block);
-}
 
-static void cmd_ps(const void *command_arg, int argc, const char * const *argv) {
-#define MAX_TASKS 32
-    TaskStatus_t tasks[MAX_TASKS];
-    uint32_t total_run_time;
-    int task_count = uxTaskGetSystemState(tasks, MAX_TASKS, &total_run_time);
-
-    printf("uptime: %d sec\n", total_run_time / 1000000);
-    printf("\x1b[4m id name         state pri  run xs-stack\x1b[0m\n");
-    for (int i = 0; i < task_count; i++) {
-        TaskStatus_t *task = &tasks[i];
-        char state = 'X';
-        if (task->eCurrentState == eRunning || task->eCurrentState == eReady) {
-            state = 'R';
-        } else if (task->eCurrentState == eBlocked) {
-            state = 'B';
-        } else if (task->eCurrentState == eSuspended) {
-            state = 'S';
-        }
-        uint32_t percent = task->ulRunTimeCounter / (total_run_time / 100);
-        uint32_t xs = sizeof(portSTACK_TYPE) * task->usStackHighWaterMark;
-        printf("%3d %-16s %c %3d %3d%% %7d\n", task->xTaskNumber, task->pcTaskName, state, task->uxCurrentPriority, percent, xs);
-    }
+    int in_use, peak, failures;
+    pool_stats(&in_use, &peak, &failures);
+    printf("pool: %d/%d blocks of %d in use, peak %d, failed %d\n", in_use, POOL_BLOCK_COUNT, POOL_BLOCK_SIZE, peak, failures);
 }
 
 static void cmd_wifi(const void *command_arg, int argc, const char * const *argv) {
@@ -62,12 +61,12 @@ static void cmd_wifi(const void *command_arg, int argc, const char * const *argv
         return;
     }
 
-    nvs_set_str(s_nvs_handle, "wifi-ssid", argv[1]);
-    nvs_set_str(s_nvs_handle, "wifi-pass", argv[2]);
-    nvs_commit(s_nvs_handle);
+    if (!settings_set_str(SETTING_WIFI_SSID, argv[1]) || !settings_set_str(SETTING_WIFI_PASS, argv[2])) {
+        printf("ssid or password is too long\n");
+        return;
+    }
+    // wifi will reconnect on its own.
     printf("changed wifi\n");
-    // don't bother trying to rebuild wifi, just reboot. it's too complex.
-    esp_restart();
 }
 
 static void cmd_name(const void *command_arg, int argc, const char * const *argv) {
@@ -76,27 +75,15 @@ static void cmd_name(const void *command_arg, int argc, const char * const *argv
         return;
     }
 
-    nvs_set_str(s_nvs_handle, "name", argv[1]);
-    nvs_commit(s_nvs_handle);
+    if (!settings_set_str(SETTING_NAME, argv[1])) {
+        printf("name is too long\n");
+        return;
+    }
     printf("changed name\n");
-    esp_restart();
-}
-
-static void cmd_config(const void *command_arg, int argc, const char * const *argv) {
-    char buffer[64];
-    size_t len;
-    len = sizeof(buffer);
-    nvs_get_str(s_nvs_handle, "name", buffer, &len);
-    printf("name: %s\n", buffer);
-    len = sizeof(buffer);
-    nvs_get_str(s_nvs_handle, "wifi-ssid", buffer, &len);
-    printf("ssid: %s\n", buffer);
-    len = sizeof(buffer);
-    nvs_get_str(s_nvs_handle, "wifi-pass", buffer, &len);
-    printf("pass: %s\n", buffer);
 }
 
 static void cmd_reboot(const void *command_arg, int argc, const char * const *argv) {
+    settings_flush();
     esp_restart();
 }
 
@@ -104,12 +91,17 @@ static void cmd_led(const void *command_arg, int argc, const char * const *argv)
     gpio_set_level(THING_GPIO_LED, cli_is_truthy(argv[1]));
 }
 
+static void name_changed(setting_t setting) {
+    char name[SETTINGS_STR_SIZE];
+    settings_get_str(SETTING_NAME, name, sizeof(name));
+    // if mdns isn't up yet, it'll read the new name when it is.
+    discovery_set_name(name);
+}
+
 static cli_command_t commands[] = {
-    { "ps", "show task list", cmd_ps, NULL, NULL },
     { "mem", "memory stats", cmd_mem, NULL, NULL },
     { "wifi <ssid> <pass>", "set wifi auth", cmd_wifi, NULL, NULL },
     { "name <name>", "set mdns name", cmd_name, NULL, NULL },
-    { "config", "show name & wifi config", cmd_config, NULL, NULL },
     { "reboot", "reboot", cmd_reboot, NULL, NULL },
     { "led", "<on|off>", cmd_led, NULL, NULL },
     CLI_LAST_COMMAND
@@ -129,7 +121,37 @@ nvs_handle_t flash_init(void) {
     return handle;
 }
 
+// wifi takes seconds to come up, so it gets its own task while the lights are already on.
+static void net_task(void *arg) {
+    perf_heap_begin(PERF_SUBSYSTEM_WIFI);
+    wifi_init(s_nvs_handle);
+    perf_heap_end(PERF_SUBSYSTEM_WIFI);
+    perf_boot_phase("wifi");
+
+    // start mDNS
+    char name[SETTINGS_STR_SIZE];
+    settings_get_str(SETTING_NAME, name, sizeof(name));
+    perf_heap_begin(PERF_SUBSYSTEM_MDNS);
+    discovery_init(name);
+    perf_heap_end(PERF_SUBSYSTEM_MDNS);
+    perf_boot_phase("mdns");
+
+    perf_heap_begin(PERF_SUBSYSTEM_HTTPD);
+    http_server_start();
+    perf_heap_end(PERF_SUBSYSTEM_HTTPD);
+    perf_boot_phase("http");
+
+    timesync_init();
+    cli_listen(CLI_TCP_PORT);
+    ota_init();
+
+    // everything's registered and online now, so provisioning scripts can do anything.
+    macro_run("boot", NULL, NULL);
+    vTaskDelete(NULL);
+}
+
 void app_main(void) {
+    perf_boot_phase("app_main");
     printf("Hello robey!\n");
 
     // gpio #5 is an annoying blue LED
@@ -144,17 +166,50 @@ void app_main(void) {
     gpio_set_level(THING_GPIO_LED, 0);
 
     s_nvs_handle = flash_init();
-    wifi_init(s_nvs_handle);
-
-    // start mDNS
-    char name[64];
-    size_t len = sizeof(name);
-    strcpy(name, "default-name");
-    nvs_get_str(s_nvs_handle, "name", name, &len);
-    ESP_ERROR_CHECK(mdns_init());
-    mdns_hostname_set(name);
+    settings_init(s_nvs_handle);
+    settings_watch(SETTING_NAME, name_changed);
+    perf_boot_phase("nvs");
 
-    cli_init(UART_NUM_0, commands);
-    http_server_start();
+    // restore the last preset before anything else, so the lights come on right away
+    perf_heap_begin(PERF_SUBSYSTEM_WS2812B);
     ws2812b_init(RMT_CHANNEL_0, NEOPIXEL_GPIO);
+    perf_heap_end(PERF_SUBSYSTEM_WS2812B);
+    perf_heap_begin(PERF_SUBSYSTEM_ANIM);
+    anim_init();
+    perf_heap_end(PERF_SUBSYSTEM_ANIM);
+    perf_heap_begin(PERF_SUBSYSTEM_VM);
+    vm_init(s_nvs_handle);
+    perf_heap_end(PERF_SUBSYSTEM_VM);
+    perf_heap_begin(PERF_SUBSYSTEM_MATRIX);
+    matrix_init(s_nvs_handle);
+    perf_heap_end(PERF_SUBSYSTEM_MATRIX);
+    perf_heap_begin(PERF_SUBSYSTEM_AUDIO);
+    audio_init();
+    perf_heap_end(PERF_SUBSYSTEM_AUDIO);
+    // the live source buffers, and the ddp receiver task
+    perf_heap_begin(PERF_SUBSYSTEM_DDP);
+    source_init();
+    ddp_init();
+    perf_heap_end(PERF_SUBSYSTEM_DDP);
+    // segments, presets, and the render task
+    perf_heap_begin(PERF_SUBSYSTEM_RENDER);
+    render_init(s_nvs_handle);
+    preset_init(s_nvs_handle);
+    render_start();
+    perf_heap_end(PERF_SUBSYSTEM_RENDER);
+    perf_boot_phase("first-light");
+
+    perf_heap_begin(PERF_SUBSYSTEM_CLI);
+    cli_init(UART_NUM_0, commands);
+    perf_init();
+    trace_init();
+    macro_init(s_nvs_handle);
+    perf_heap_end(PERF_SUBSYSTEM_CLI);
+    perf_heap_begin(PERF_SUBSYSTEM_PROFILER);
+    profiler_init();
+    perf_heap_end(PERF_SUBSYSTEM_PROFILER);
+    perf_boot_phase("cli");
+
+    TaskHandle_t task;
+    xTaskCreate(net_task, "net", NET_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 1, &task);
 }
@@ -0,0 +1,202 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "cli.h"
+#include "matrix.h"
+#include "pool.h"
+#include "render.h"
+#include "settings.h"
+
+#define NVS_KEY "matrix-table"
+
+static nvs_handle_t s_nvs_handle;
+static SemaphoreHandle_t s_lock;
+
+// everything below is protected by `s_lock`
+static uint16_t s_map[RENDER_MAX_PIXELS];
+static int s_width = 0;
+static int s_height = 0;
+// the custom table, indexed by panel cell
+static uint16_t s_table[RENDER_MAX_PIXELS];
+static int s_table_count = 0;
+
+
+// recompute `s_map` from the settings and custom table. (`s_lock` must be held.)
+static void build(void) {
+    int panel_width = settings_get_int(SETTING_MATRIX_WIDTH);
+    int panel_height = settings_get_int(SETTING_MATRIX_HEIGHT);
+    matrix_layout_t layout = settings_get_int(SETTING_MATRIX_LAYOUT);
+    matrix_rotate_t rotate = settings_get_int(SETTING_MATRIX_ROTATE);
+
+    for (int i = 0; i < RENDER_MAX_PIXELS; i++) s_map[i] = i;
+    s_width = s_height = 0;
+    if (panel_width == 0 || panel_height == 0) return;
+    if (panel_width * panel_height > RENDER_MAX_PIXELS) {
+        printf("matrix: %dx%d is more than %d pixels; ignoring it\n", panel_width, panel_height, RENDER_MAX_PIXELS);
+        return;
+    }
+    if (layout == MATRIX_CUSTOM && s_table_count != panel_width * panel_height) {
+        printf("matrix: custom table has %d cells, not %d; using rows\n", s_table_count, panel_width * panel_height);
+        layout = MATRIX_ROWS;
+    }
+
+    bool turned = (rotate == MATRIX_ROTATE_90 || rotate == MATRIX_ROTATE_270);
+    s_width = turned ? panel_height : panel_width;
+    s_height = turned ? panel_width : panel_height;
+    for (int y = 0; y < s_height; y++) {
+        for (int x = 0; x < s_width; x++) {
+            int px, py;
+            switch (rotate) {
+                case MATRIX_ROTATE_90: px = y; py = panel_height - 1 - x; break;
+                case MATRIX_ROTATE_180: px = panel_width - 1 - x; py = panel_height - 1 - y; break;
+                case MATRIX_ROTATE_270: px = panel_width - 1 - y; py = x; break;
+                default: px = x; py = y; break;
+            }
+            int cell = py * panel_width + px;
+            if (layout == MATRIX_CUSTOM) {
+                s_map[y * s_width + x] = s_table[cell];
+            } else if (layout == MATRIX_SERPENTINE && (py & 1)) {
+                s_map[y * s_width + x] = py * panel_width + panel_width - 1 - px;
+            } else {
+                s_map[y * s_width + x] = cell;
+            }
+        }
+    }
+}
+
+static void setting_changed(setting_t setting) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    build();
+    xSemaphoreGive(s_lock);
+    render_redraw();
+}
+
+
+// ----- API
+
+int matrix_width(void) {
+    return s_width;
+}
+
+int matrix_height(void) {
+    return s_height;
+}
+
+const uint16_t *matrix_lock(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    return s_map;
+}
+
+void matrix_unlock(void) {
+    xSemaphoreGive(s_lock);
+}
+
+const char *matrix_set_table(const char *text) {
+    uint16_t *table = pool_alloc(sizeof(s_table));
+    if (table == NULL) return "out of memory";
+    int count = 0;
+    const char *p = text;
+    while (true) {
+        while (isspace((int) *p) || *p == ',') p++;
+        if (*p == 0) break;
+        if (count == RENDER_MAX_PIXELS) {
+            pool_free(table);
+            return "too many cells";
+        }
+        if (*p == '-' && (p[1] == 0 || p[1] == ',' || isspace((int) p[1]))) {
+            table[count++] = MATRIX_NONE;
+            p++;
+            continue;
+        }
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+        if (end == p || n >= RENDER_MAX_PIXELS) {
+            pool_free(table);
+            return "cells must be LED numbers (below RENDER_MAX_PIXELS) or -";
+        }
+        table[count++] = n;
+        p = end;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(s_table, table, count * sizeof(uint16_t));
+    s_table_count = count;
+    build();
+    xSemaphoreGive(s_lock);
+
+    // save from our copy, so the renderer isn't stuck waiting on flash.
+    if (count > 0) {
+        nvs_set_blob(s_nvs_handle, NVS_KEY, table, count * sizeof(uint16_t));
+    } else {
+        nvs_erase_key(s_nvs_handle, NVS_KEY);
+    }
+    nvs_commit(s_nvs_handle);
+    pool_free(table);
+    render_redraw();
+    return NULL;
+}
+
+
+// ----- CLI
+
+// draw the map as a grid of LED numbers
+static void cmd_matrix_show(const void *command_arg, int argc, const char * const *argv) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_width == 0) {
+        printf("no matrix (set matrix-width & matrix-height)\n");
+    } else {
+        printf("%dx%d:\n", s_width, s_height);
+        for (int y = 0; y < s_height; y++) {
+            for (int x = 0; x < s_width; x++) {
+                uint16_t led = s_map[y * s_width + x];
+                if (led == MATRIX_NONE) printf("   -"); else printf("%4u", led);
+            }
+            printf("\n");
+        }
+    }
+    if (s_table_count > 0) printf("custom table: %d cells\n", s_table_count);
+    xSemaphoreGive(s_lock);
+}
+
+static void cmd_matrix_table(const void *command_arg, int argc, const char * const *argv) {
+    char text[CLI_BUFFER_SIZE];
+    text[0] = 0;
+    for (int i = 1; i < argc; i++) {
+        strlcat(text, argv[i], sizeof(text));
+        strlcat(text, " ", sizeof(text));
+    }
+    const char *error = matrix_set_table(text);
+    if (error != NULL) printf("%s\n", error);
+}
+
+static cli_command_t matrix_commands[] = {
+    { "show", "draw the pixel map", cmd_matrix_show, NULL, NULL },
+    { "table [cells...]", "set (or clear) the custom layout's table", cmd_matrix_table, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "matrix", NULL, NULL, NULL, matrix_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void matrix_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    s_lock = xSemaphoreCreateMutex();
+
+    size_t len = sizeof(s_table);
+    if (nvs_get_blob(s_nvs_handle, NVS_KEY, s_table, &len) == ESP_OK) s_table_count = len / sizeof(uint16_t);
+    build();
+
+    settings_watch(SETTING_MATRIX_WIDTH, setting_changed);
+    settings_watch(SETTING_MATRIX_HEIGHT, setting_changed);
+    settings_watch(SETTING_MATRIX_LAYOUT, setting_changed);
+    settings_watch(SETTING_MATRIX_ROTATE, setting_changed);
+    if (s_width > 0) printf("matrix_init: %dx%d\n", s_width, s_height);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include "nvs_flash.h"
+
+/*
+ * maps "logical" pixels -- what effects and segments see -- to physical
+ * LEDs on the strip. with a matrix configured (matrix-width/height in
+ * settings), logical pixel y * width + x is that cell of the matrix in
+ * row-major order, wherever the wiring actually put it. 2D effects just
+ * write rows; the render task looks every pixel up in one precomputed
+ * table, so it costs the same as a linear strip.
+ *
+ * width & height describe the physical panel (rows of `width` LEDs as
+ * wired). rotation turns the logical view, so at 90 or 270 the logical
+ * width is the panel's height. pixels past the matrix map to themselves.
+ */
+
+typedef enum {
+    // every row runs the same direction
+    MATRIX_ROWS = 0,
+    // odd rows run backwards (the usual zigzag wiring)
+    MATRIX_SERPENTINE,
+    // the uploaded lookup table, for rings & anything irregular
+    MATRIX_CUSTOM,
+} matrix_layout_t;
+
+typedef enum {
+    MATRIX_ROTATE_0 = 0,
+    MATRIX_ROTATE_90,
+    MATRIX_ROTATE_180,
+    MATRIX_ROTATE_270,
+} matrix_rotate_t;
+
+// a logical pixel with no LED behind it (a gap in a custom table)
+#define MATRIX_NONE 0xffff
+
+// load the custom table from NVS, build the map, and register CLI commands.
+void matrix_init(nvs_handle_t nvs_handle);
+
+// logical size, after rotation. both are 0 if there's no matrix.
+int matrix_width(void);
+int matrix_height(void);
+
+/*
+ * the logical -> physical table, RENDER_MAX_PIXELS long. hold it with
+ * `matrix_lock` for as long as you use it, since a settings change rebuilds
+ * it in place.
+ */
+const uint16_t *matrix_lock(void);
+void matrix_unlock(void);
+
+/*
+ * set the custom table from text: the physical LED for each panel cell, in
+ * row-major order (before rotation), separated by spaces or commas. "-"
+ * marks a cell with no LED. empty text clears it. returns NULL on success,
+ * or why it was rejected.
+ */
+const char *matrix_set_table(const char *text);
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "cli.h"
+#include "ota.h"
+#include "settings.h"
+#include "wifi.h"
+
+#define HEALTH_CHECK_MS 1000
+
+static esp_timer_handle_t s_health_timer;
+static int64_t s_health_start = 0;
+static esp_timer_handle_t s_restart_timer;
+
+
+static void health_callback(void *arg) {
+    if (wifi_is_online()) {
+        esp_timer_stop(s_health_timer);
+        esp_ota_mark_app_valid_cancel_rollback();
+        printf("ota: new image is healthy\n");
+        return;
+    }
+    if (esp_timer_get_time() - s_health_start >= (int64_t) OTA_HEALTH_TIMEOUT_MS * 1000) {
+        printf("ota: new image never got online; rolling back\n");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+static void restart_callback(void *arg) {
+    settings_flush();
+    esp_restart();
+}
+
+// (ESP_OTA_IMG_UNDEFINED is 0xffffffff, so this can't be a table)
+static const char *state_name(esp_ota_img_states_t state) {
+    switch (state) {
+        case ESP_OTA_IMG_NEW: return "new";
+        case ESP_OTA_IMG_PENDING_VERIFY: return "pending-verify";
+        case ESP_OTA_IMG_VALID: return "valid";
+        case ESP_OTA_IMG_INVALID: return "invalid";
+        case ESP_OTA_IMG_ABORTED: return "aborted";
+        default: return "undefined";
+    }
+}
+
+
+// ----- CLI
+
+static void cmd_ota(const void *command_arg, int argc, const char * const *argv) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *next = esp_ota_get_next_update_partition(NULL);
+    esp_ota_img_states_t state;
+    // (fails when the image was flashed over serial, without OTA data)
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK) state = ESP_OTA_IMG_UNDEFINED;
+
+    printf("running: %s @ 0x%06x, version %s (%s)\n", running->label, running->address,
+        esp_ota_get_app_description()->version, state_name(state));
+    if (next != NULL) printf("next update: %s @ 0x%06x, %u KB\n", next->label, next->address, next->size / 1024);
+}
+
+static cli_command_t commands[] = {
+    { "ota", "show firmware partitions", cmd_ota, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+// ----- API
+
+void ota_init(void) {
+    esp_timer_create_args_t restart_timer_args = {
+        .callback = restart_callback,
+        .name = "ota-restart",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&restart_timer_args, &s_restart_timer));
+    cli_register_commands(commands);
+
+    esp_ota_img_states_t state;
+    if (
+        esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY
+    ) return;
+
+    printf("ota: new image, checking health\n");
+    esp_timer_create_args_t timer_args = {
+        .callback = health_callback,
+        .name = "ota-health",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_health_timer));
+    s_health_start = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_health_timer, HEALTH_CHECK_MS * 1000));
+}
+
+void ota_restart(uint32_t ms) {
+    esp_timer_start_once(s_restart_timer, ms * 1000);
+}
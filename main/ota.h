@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * firmware updates are written by POST /ota into whichever app partition
+ * isn't running. the first boot of a new image is on probation: if it
+ * doesn't get onto the network within OTA_HEALTH_TIMEOUT_MS, the
+ * bootloader rolls back to the previous image.
+ */
+
+#ifndef OTA_HEALTH_TIMEOUT_MS
+#define OTA_HEALTH_TIMEOUT_MS 60000
+#endif
+
+// start the health check (if this is a new image) and register CLI commands. call once networking is started.
+void ota_init(void);
+
+// save settings and reboot after `ms`, so an http response has time to go out.
+void ota_restart(uint32_t ms);
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "cli.h"
+#include "perf.h"
+#include "pool.h"
+#include "trace.h"
+
+static const char *SUBSYSTEM_NAMES[PERF_SUBSYSTEM_COUNT] = {
+    [PERF_SUBSYSTEM_WS2812B] = "ws2812b",
+    [PERF_SUBSYSTEM_ANIM] = "anim",
+    [PERF_SUBSYSTEM_VM] = "vm",
+    [PERF_SUBSYSTEM_MATRIX] = "matrix",
+    [PERF_SUBSYSTEM_AUDIO] = "audio",
+    [PERF_SUBSYSTEM_DDP] = "ddp",
+    [PERF_SUBSYSTEM_RENDER] = "render",
+    [PERF_SUBSYSTEM_CLI] = "cli",
+    [PERF_SUBSYSTEM_PROFILER] = "profiler",
+    [PERF_SUBSYSTEM_WIFI] = "wifi",
+    [PERF_SUBSYSTEM_MDNS] = "mdns",
+    [PERF_SUBSYSTEM_HTTPD] = "httpd",
+};
+
+static const char *TIMER_NAMES[PERF_TIMER_COUNT] = {
+    [PERF_TIMER_RENDER] = "render",
+    [PERF_TIMER_ENCODE] = "encode",
+    [PERF_TIMER_TRANSMIT] = "transmit",
+    [PERF_TIMER_WIFI_CONNECT] = "wifi",
+    [PERF_TIMER_AUDIO] = "audio",
+};
+
+typedef struct {
+    uint32_t count;
+    uint32_t last;
+    uint32_t max;
+    uint64_t total;
+} timer_stats_t;
+
+static struct {
+    const char *name;
+    int64_t time;
+} s_boot_phases[PERF_MAX_BOOT_PHASES];
+static int s_boot_phase_count = 0;
+
+static uint32_t s_heap_mark[PERF_SUBSYSTEM_COUNT];
+static int32_t s_heap_used[PERF_SUBSYSTEM_COUNT];
+
+static portMUX_TYPE s_timer_lock = portMUX_INITIALIZER_UNLOCKED;
+static timer_stats_t s_timers[PERF_TIMER_COUNT];
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    // since boot. bumped without a lock, so two same-named tasks can lose a count now and then.
+    uint32_t count;
+    uint32_t bytes;
+    // as of the last tick of the rate timer
+    uint32_t last_count;
+    uint32_t last_bytes;
+    uint32_t rate;
+    uint32_t byte_rate;
+    uint32_t peak_rate;
+} alloc_stats_t;
+
+// the first few slots are for allocs that don't belong to a task
+#define ALLOC_SLOT_ISR 0
+#define ALLOC_SLOT_BOOT 1
+#define ALLOC_SLOT_OTHER 2
+
+static alloc_stats_t s_allocs[PERF_MAX_ALLOC_TASKS] = {
+    [ALLOC_SLOT_ISR] = { .name = "(isr)" },
+    [ALLOC_SLOT_BOOT] = { .name = "(boot)" },
+    [ALLOC_SLOT_OTHER] = { .name = "(other)" },
+};
+static volatile int s_alloc_count = 3;
+static portMUX_TYPE s_alloc_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_alloc_timer;
+
+
+void perf_boot_phase(const char *name) {
+    int64_t now = esp_timer_get_time();
+    if (s_boot_phase_count < PERF_MAX_BOOT_PHASES) {
+        s_boot_phases[s_boot_phase_count].name = name;
+        s_boot_phases[s_boot_phase_count].time = now;
+        s_boot_phase_count++;
+    }
+    printf("boot: %-12s %6lld ms\n", name, now / 1000);
+}
+
+void perf_heap_begin(perf_subsystem_t subsystem) {
+    s_heap_mark[subsystem] = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+void perf_heap_end(perf_subsystem_t subsystem) {
+    s_heap_used[subsystem] += (int32_t) (s_heap_mark[subsystem] - heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+}
+
+void perf_timer_record(perf_timer_t timer, int64_t start) {
+    uint32_t elapsed = (uint32_t) (esp_timer_get_time() - start);
+    timer_stats_t *t = &s_timers[timer];
+
+    portENTER_CRITICAL(&s_timer_lock);
+    t->count++;
+    t->last = elapsed;
+    t->total += elapsed;
+    if (elapsed > t->max) t->max = elapsed;
+    portEXIT_CRITICAL(&s_timer_lock);
+    trace_span(TIMER_NAMES[timer], start);
+}
+
+// which slot the caller's allocs go in, claiming one the first time a task name shows up
+static int alloc_slot(void) {
+    if (xPortInIsrContext()) return ALLOC_SLOT_ISR;
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED) return ALLOC_SLOT_BOOT;
+    const char *name = pcTaskGetTaskName(NULL);
+    int count = s_alloc_count;
+    for (int i = ALLOC_SLOT_OTHER + 1; i < count; i++) {
+        if (strncmp(s_allocs[i].name, name, configMAX_TASK_NAME_LEN) == 0) return i;
+    }
+
+    int slot = ALLOC_SLOT_OTHER;
+    portENTER_CRITICAL(&s_alloc_lock);
+    // another task may have slipped in before we got the lock.
+    for (int i = count; i < s_alloc_count; i++) {
+        if (strncmp(s_allocs[i].name, name, configMAX_TASK_NAME_LEN) == 0) slot = i;
+    }
+    if (slot == ALLOC_SLOT_OTHER && s_alloc_count < PERF_MAX_ALLOC_TASKS) {
+        slot = s_alloc_count;
+        strncpy(s_allocs[slot].name, name, configMAX_TASK_NAME_LEN - 1);
+        s_alloc_count = slot + 1;
+    }
+    portEXIT_CRITICAL(&s_alloc_lock);
+    return slot;
+}
+
+static void count_alloc(size_t size) {
+    alloc_stats_t *a = &s_allocs[alloc_slot()];
+    a->count++;
+    a->bytes += size;
+}
+
+// the linker sends every call to malloc/calloc/realloc here instead (-Wl,--wrap).
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    count_alloc(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    count_alloc(n * size);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    count_alloc(size);
+    return __real_realloc(ptr, size);
+}
+
+static void alloc_timer_callback(void *arg) {
+    int count = s_alloc_count;
+    for (int i = 0; i < count; i++) {
+        alloc_stats_t *a = &s_allocs[i];
+        uint32_t now = a->count, bytes = a->bytes;
+        a->rate = now - a->last_count;
+        a->byte_rate = bytes - a->last_bytes;
+        a->last_count = now;
+        a->last_bytes = bytes;
+        if (a->rate > a->peak_rate) a->peak_rate = a->rate;
+    }
+}
+
+// consistent copy of the timer stats
+static void copy_timers(timer_stats_t *timers, bool reset) {
+    portENTER_CRITICAL(&s_timer_lock);
+    memcpy(timers, s_timers, sizeof(s_timers));
+    if (reset) memset(s_timers, 0, sizeof(s_timers));
+    portEXIT_CRITICAL(&s_timer_lock);
+}
+
+void perf_write_metrics(perf_write_t write, void *context) {
+    char line[128];
+    multi_heap_info_t heap_info;
+    heap_caps_get_info(&heap_info, MALLOC_CAP_DEFAULT);
+    timer_stats_t timers[PERF_TIMER_COUNT];
+    copy_timers(timers, false);
+
+    snprintf(line, sizeof(line), "# TYPE glowball_uptime_seconds gauge\nglowball_uptime_seconds %lld\n",
+        esp_timer_get_time() / 1000000);
+    write(context, line);
+
+    write(context, "# TYPE glowball_heap_bytes gauge\n");
+    snprintf(line, sizeof(line), "glowball_heap_bytes{kind=\"free\"} %u\nglowball_heap_bytes{kind=\"min_free\"} %u\n",
+        heap_info.total_free_bytes, xPortGetMinimumEverFreeHeapSize());
+    write(context, line);
+    snprintf(line, sizeof(line), "glowball_heap_bytes{kind=\"largest_free_block\"} %u\n", heap_info.largest_free_block);
+    write(context, line);
+
+    int pool_in_use, pool_peak, pool_failures;
+    pool_stats(&pool_in_use, &pool_peak, &pool_failures);
+    snprintf(line, sizeof(line), "# TYPE glowball_pool_blocks gauge\nglowball_pool_blocks{kind=\"in_use\"} %d\nglowball_pool_blocks{kind=\"peak\"} %d\n",
+        pool_in_use, pool_peak);
+    write(context, line);
+    snprintf(line, sizeof(line), "# TYPE glowball_pool_failures_total counter\nglowball_pool_failures_total %d\n", pool_failures);
+    write(context, line);
+
+    write(context, "# TYPE glowball_allocs_total counter\n");
+    int alloc_count = s_alloc_count;
+    for (int i = 0; i < alloc_count; i++) {
+        snprintf(line, sizeof(line), "glowball_allocs_total{task=\"%s\"} %u\n", s_allocs[i].name, s_allocs[i].count);
+        write(context, line);
+    }
+    write(context, "# TYPE glowball_alloc_bytes_total counter\n");
+    for (int i = 0; i < alloc_count; i++) {
+        snprintf(line, sizeof(line), "glowball_alloc_bytes_total{task=\"%s\"} %u\n", s_allocs[i].name, s_allocs[i].bytes);
+        write(context, line);
+    }
+
+    write(context, "# TYPE glowball_subsystem_heap_bytes gauge\n");
+    for (int i = 0; i < PERF_SUBSYSTEM_COUNT; i++) {
+        snprintf(line, sizeof(line), "glowball_subsystem_heap_bytes{subsystem=\"%s\"} %d\n", SUBSYSTEM_NAMES[i], s_heap_used[i]);
+        write(context, line);
+    }
+
+    write(context, "# TYPE glowball_boot_phase_seconds gauge\n");
+    for (int i = 0; i < s_boot_phase_count; i++) {
+        snprintf(line, sizeof(line), "glowball_boot_phase_seconds{phase=\"%s\"} %.6f\n",
+            s_boot_phases[i].name, s_boot_phases[i].time / 1000000.0);
+        write(context, line);
+    }
+
+    write(context, "# TYPE glowball_stage_seconds summary\n");
+    for (int i = 0; i < PERF_TIMER_COUNT; i++) {
+        snprintf(line, sizeof(line), "glowball_stage_seconds_sum{stage=\"%s\"} %.6f\nglowball_stage_seconds_count{stage=\"%s\"} %u\n",
+            TIMER_NAMES[i], timers[i].total / 1000000.0, TIMER_NAMES[i], timers[i].count);
+        write(context, line);
+    }
+    write(context, "# TYPE glowball_stage_max_seconds gauge\n");
+    for (int i = 0; i < PERF_TIMER_COUNT; i++) {
+        snprintf(line, sizeof(line), "glowball_stage_max_seconds{stage=\"%s\"} %.6f\n", TIMER_NAMES[i], timers[i].max / 1000000.0);
+        write(context, line);
+    }
+}
+
+
+// ----- CLI
+
+static void cmd_perf(const void *command_arg, int argc, const char * const *argv) {
+    timer_stats_t timers[PERF_TIMER_COUNT];
+    copy_timers(timers, argc > 1 && strcmp(argv[1], "reset") == 0);
+
+    printf("\x1b[4mboot phase        at ms  took ms\x1b[0m\n");
+    int64_t last = 0;
+    for (int i = 0; i < s_boot_phase_count; i++) {
+        printf("%-16s %6lld %8lld\n", s_boot_phases[i].name, s_boot_phases[i].time / 1000, (s_boot_phases[i].time - last) / 1000);
+        last = s_boot_phases[i].time;
+    }
+
+    printf("\x1b[4msubsystem     heap\x1b[0m\n");
+    for (int i = 0; i < PERF_SUBSYSTEM_COUNT; i++) printf("%-10s %7d\n", SUBSYSTEM_NAMES[i], s_heap_used[i]);
+
+    printf("\x1b[4mstage       count   avg us   max us  last us\x1b[0m\n");
+    for (int i = 0; i < PERF_TIMER_COUNT; i++) {
+        timer_stats_t *t = &timers[i];
+        printf("%-10s %6u %8u %8u %8u\n", TIMER_NAMES[i], t->count, t->count ? (uint32_t) (t->total / t->count) : 0, t->max, t->last);
+    }
+}
+
+static void cmd_allocs(const void *command_arg, int argc, const char * const *argv) {
+    printf("\x1b[4mtask             allocs/s   peak/s  bytes/s     total\x1b[0m\n");
+    int count = s_alloc_count;
+    for (int i = 0; i < count; i++) {
+        alloc_stats_t *a = &s_allocs[i];
+        if (a->count == 0) continue;
+        printf("%-16s %8u %8u %8u %9u\n", a->name, a->rate, a->peak_rate, a->byte_rate, a->count);
+    }
+}
+
+static cli_command_t commands[] = {
+    { "perf [reset]", "show boot, heap, frame, and wifi timings", cmd_perf, NULL, NULL },
+    { "allocs", "show heap allocations per second, by task", cmd_allocs, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+void perf_init(void) {
+    esp_timer_create_args_t timer_args = {
+        .callback = alloc_timer_callback,
+        .name = "perf-allocs",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_alloc_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_alloc_timer, 1000 * 1000));
+    cli_register_commands(commands);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_timer.h"
+
+/*
+ * lightweight instrumentation: boot phase timestamps, heap used by each
+ * subsystem's init, and running stats for timed stages of the frame path.
+ * all of it is cheap enough to leave on all the time.
+ */
+
+#ifndef PERF_MAX_BOOT_PHASES
+#define PERF_MAX_BOOT_PHASES 12
+#endif
+
+/*
+ * every malloc, calloc, and realloc is counted against the task that made
+ * it (the linker wraps them; see CMakeLists.txt), and turned into a rate
+ * once a second. tasks with the same name share a slot.
+ */
+#ifndef PERF_MAX_ALLOC_TASKS
+#define PERF_MAX_ALLOC_TASKS 24
+#endif
+
+typedef enum {
+    PERF_SUBSYSTEM_WS2812B = 0,
+    PERF_SUBSYSTEM_ANIM,
+    PERF_SUBSYSTEM_VM,
+    PERF_SUBSYSTEM_MATRIX,
+    PERF_SUBSYSTEM_AUDIO,
+    PERF_SUBSYSTEM_DDP,
+    PERF_SUBSYSTEM_RENDER,
+    PERF_SUBSYSTEM_CLI,
+    PERF_SUBSYSTEM_PROFILER,
+    PERF_SUBSYSTEM_WIFI,
+    PERF_SUBSYSTEM_MDNS,
+    PERF_SUBSYSTEM_HTTPD,
+    PERF_SUBSYSTEM_COUNT,
+} perf_subsystem_t;
+
+typedef enum {
+    PERF_TIMER_RENDER = 0,
+    PERF_TIMER_ENCODE,
+    PERF_TIMER_TRANSMIT,
+    PERF_TIMER_WIFI_CONNECT,
+    PERF_TIMER_AUDIO,
+    PERF_TIMER_COUNT,
+} perf_timer_t;
+
+// receives chunks of text, for `perf_write_metrics`
+typedef void (*perf_write_t)(void *context, const char *text);
+
+// start the alloc rate timer, and register CLI commands
+void perf_init(void);
+
+// log and remember a timestamp for the end of a boot phase
+void perf_boot_phase(const char *name);
+
+/*
+ * bracket a subsystem's init with these to account for how much heap it
+ * kept. it's measured as the change in free heap, so it's only accurate if
+ * nothing else is allocating at the same time.
+ */
+void perf_heap_begin(perf_subsystem_t subsystem);
+void perf_heap_end(perf_subsystem_t subsystem);
+
+// current time in usec, for passing to `perf_timer_record` later
+static inline int64_t perf_now(void) {
+    return esp_timer_get_time();
+}
+
+// record how long a stage took, given the `perf_now()` from when it started (and trace it)
+void perf_timer_record(perf_timer_t timer, int64_t start);
+
+// write all metrics in prometheus text format
+void perf_write_metrics(perf_write_t write, void *context);
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+#include "pool.h"
+
+_Static_assert(POOL_BLOCK_COUNT <= 32, "pool keeps its free list in a uint32_t");
+
+static uint8_t s_blocks[POOL_BLOCK_COUNT][POOL_BLOCK_SIZE] __attribute__((aligned(4)));
+// bit n set = block n is in use
+static uint32_t s_used = 0;
+static int s_peak = 0;
+static int s_failures = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+void *pool_alloc(size_t size) {
+    void *block = NULL;
+    portENTER_CRITICAL(&s_lock);
+    if (size <= POOL_BLOCK_SIZE) {
+        for (int i = 0; i < POOL_BLOCK_COUNT; i++) {
+            if (s_used & (1 << i)) continue;
+            s_used |= (1 << i);
+            block = s_blocks[i];
+            break;
+        }
+    }
+    if (block == NULL) {
+        s_failures++;
+    } else {
+        int in_use = __builtin_popcount(s_used);
+        if (in_use > s_peak) s_peak = in_use;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return block;
+}
+
+void pool_free(void *block) {
+    if (block == NULL) return;
+    int i = ((uint8_t *) block - s_blocks[0]) / POOL_BLOCK_SIZE;
+    portENTER_CRITICAL(&s_lock);
+    s_used &= ~(1 << i);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void pool_stats(int *in_use, int *peak, int *failures) {
+    portENTER_CRITICAL(&s_lock);
+    *in_use = __builtin_popcount(s_used);
+    *peak = s_peak;
+    *failures = s_failures;
+    portEXIT_CRITICAL(&s_lock);
+}
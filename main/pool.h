@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * a few fixed-size blocks, reserved statically, for the short-lived buffers
+ * that used to come from malloc on every request: HTTP bodies and upload
+ * chunks, macro scripts, and the like. the heap never sees them, so a device
+ * that's been up for weeks can't end up too fragmented to find 4KB.
+ *
+ * a block is all-or-nothing: if they're all in use, `pool_alloc` returns
+ * NULL and the caller fails the same way it would have if malloc had.
+ */
+
+#ifndef POOL_BLOCK_SIZE
+#define POOL_BLOCK_SIZE 4096
+#endif
+
+// the http server handles one request at a time, but a /cli script can run a macro, which can set a matrix table...
+#ifndef POOL_BLOCK_COUNT
+#define POOL_BLOCK_COUNT 4
+#endif
+
+// a POOL_BLOCK_SIZE block, or NULL if they're all in use (or `size` is too big)
+void *pool_alloc(size_t size);
+void pool_free(void *block);
+
+// blocks in use now, the most ever in use at once, and how many allocs failed
+void pool_stats(int *in_use, int *peak, int *failures);
@@ -0,0 +1,153 @@
+/*
+ * a preset is the brightness plus the whole segment table (which carries
+ * each segment's effect and color), stored as one binary blob in NVS:
+ *
+ *     version (1 byte), brightness (1), segment count (1), reserved (1),
+ *     then `segment_t` * count
+ *
+ * recalling a preset is a single NVS read and a table swap, which is cheap
+ * enough to do at boot before wifi is up.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cli.h"
+#include "preset.h"
+#include "render.h"
+
+#define PRESET_VERSION 1
+#define NO_PRESET 0xff
+
+typedef struct {
+    uint8_t version;
+    uint8_t brightness;
+    uint8_t count;
+    uint8_t reserved;
+    segment_t segments[RENDER_MAX_SEGMENTS];
+} preset_t;
+
+static nvs_handle_t s_nvs_handle;
+static uint8_t s_active = NO_PRESET;
+
+
+static void preset_key(int id, char *key) {
+    snprintf(key, 12, "preset-%d", id);
+}
+
+static void set_active(int id) {
+    s_active = id;
+    nvs_set_u8(s_nvs_handle, "preset-last", s_active);
+    nvs_commit(s_nvs_handle);
+}
+
+static bool load(int id, preset_t *preset) {
+    if (id < 0 || id >= PRESET_MAX) return false;
+    char key[12];
+    preset_key(id, key);
+    size_t len = sizeof(preset_t);
+    if (nvs_get_blob(s_nvs_handle, key, preset, &len) != ESP_OK) return false;
+    if (preset->version != PRESET_VERSION || preset->count > RENDER_MAX_SEGMENTS) return false;
+    return len == offsetof(preset_t, segments) + preset->count * sizeof(segment_t);
+}
+
+static void apply(const preset_t *preset) {
+    render_set_brightness(preset->brightness);
+    render_segment_replace(preset->segments, preset->count);
+}
+
+
+// ----- API
+
+bool preset_save(int id) {
+    if (id < 0 || id >= PRESET_MAX) return false;
+    preset_t preset;
+    preset.version = PRESET_VERSION;
+    preset.brightness = render_brightness();
+    preset.count = render_segment_list(preset.segments, RENDER_MAX_SEGMENTS);
+    preset.reserved = 0;
+
+    char key[12];
+    preset_key(id, key);
+    if (nvs_set_blob(s_nvs_handle, key, &preset, offsetof(preset_t, segments) + preset.count * sizeof(segment_t)) != ESP_OK) {
+        return false;
+    }
+    set_active(id);
+    return true;
+}
+
+bool preset_recall(int id, uint32_t ms) {
+    preset_t preset;
+    if (!load(id, &preset)) return false;
+    if (ms > 0) render_transition(ms);
+    apply(&preset);
+    set_active(id);
+    return true;
+}
+
+bool preset_erase(int id) {
+    if (id < 0 || id >= PRESET_MAX) return false;
+    char key[12];
+    preset_key(id, key);
+    if (nvs_erase_key(s_nvs_handle, key) != ESP_OK) return false;
+    if (s_active == id) set_active(NO_PRESET);
+    nvs_commit(s_nvs_handle);
+    return true;
+}
+
+int preset_active(void) {
+    return s_active == NO_PRESET ? -1 : s_active;
+}
+
+
+// ----- CLI
+
+static void cmd_preset_list(const void *command_arg, int argc, const char * const *argv) {
+    preset_t preset;
+    for (int i = 0; i < PRESET_MAX; i++) {
+        if (!load(i, &preset)) continue;
+        printf("%c%2d: brightness %3d, %d segments\n", i == s_active ? '*' : ' ', i, preset.brightness, preset.count);
+    }
+}
+
+static void cmd_preset_save(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2 || !preset_save(atoi(argv[1]))) printf("usage: preset save <0-%d>\n", PRESET_MAX - 1);
+}
+
+static void cmd_preset_load(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2 || !preset_recall(atoi(argv[1]), argc > 2 ? atoi(argv[2]) : 0)) printf("no such preset\n");
+}
+
+static void cmd_preset_del(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2 || !preset_erase(atoi(argv[1]))) printf("no such preset\n");
+}
+
+static cli_command_t preset_commands[] = {
+    { "list", "show saved presets", cmd_preset_list, NULL, NULL },
+    { "save <id>", "save current state as a preset", cmd_preset_save, NULL, NULL },
+    { "load <id> [ms]", "recall a preset", cmd_preset_load, NULL, NULL },
+    { "del <id>", "erase a preset", cmd_preset_del, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "preset", NULL, NULL, NULL, preset_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void preset_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    cli_register_commands(commands);
+
+    nvs_get_u8(s_nvs_handle, "preset-last", &s_active);
+    if (s_active == NO_PRESET) return;
+
+    preset_t preset;
+    if (load(s_active, &preset)) {
+        apply(&preset);
+        printf("preset_init: restored preset %d\n", s_active);
+    } else {
+        s_active = NO_PRESET;
+    }
+}
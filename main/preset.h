@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nvs_flash.h"
+
+// preset ids are 0 through PRESET_MAX - 1
+#ifndef PRESET_MAX
+#define PRESET_MAX 16
+#endif
+
+/*
+ * restore the last-active preset (if any) and register CLI commands.
+ * call this after `render_init` and before `render_start`, so the first
+ * frame out of the render task is already the restored preset.
+ */
+void preset_init(nvs_handle_t nvs_handle);
+
+// save the current brightness and segments as preset `id`.
+bool preset_save(int id);
+
+// load preset `id`, fading over `ms` msec. returns false if there's no such preset.
+bool preset_recall(int id, uint32_t ms);
+
+bool preset_erase(int id);
+
+// the most recently saved or recalled preset, or -1
+int preset_active(void);
@@ -0,0 +1,227 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "cli.h"
+#include "pool.h"
+#include "profiler.h"
+
+// stack marks are kept every 10 seconds
+#define STACK_HISTORY (PROFILER_HISTORY / 10)
+// `top` gives up after this many redraws (5 minutes)
+#define TOP_MAX_REFRESHES 300
+
+_Static_assert(PROFILER_MAX_TASKS * sizeof(profiler_row_t) <= POOL_BLOCK_SIZE, "rows are copied into a pool block");
+
+typedef struct {
+    // 0 means the slot is free
+    UBaseType_t number;
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t priority;
+    char state;
+    uint32_t last_run;
+    // tenths of a percent, for each second. `seconds` of them are valid, ending at the newest sample.
+    uint16_t load[PROFILER_HISTORY];
+    int seconds;
+    uint32_t stack_free;
+    uint32_t stack_history[STACK_HISTORY];
+    bool seen;
+} profile_t;
+
+// only touched by the profiler task
+static TaskStatus_t s_status[PROFILER_MAX_TASKS];
+static uint32_t s_last_total = 0;
+
+static SemaphoreHandle_t s_lock;
+static profile_t s_profiles[PROFILER_MAX_TASKS];
+// samples taken so far
+static uint32_t s_tick = 0;
+
+
+static char state_char(eTaskState state) {
+    if (state == eRunning || state == eReady) return 'R';
+    if (state == eBlocked) return 'B';
+    if (state == eSuspended) return 'S';
+    return 'X';
+}
+
+static profile_t *find_profile(UBaseType_t number) {
+    profile_t *free_slot = NULL;
+    for (int i = 0; i < PROFILER_MAX_TASKS; i++) {
+        if (s_profiles[i].number == number) return &s_profiles[i];
+        if (s_profiles[i].number == 0 && free_slot == NULL) free_slot = &s_profiles[i];
+    }
+    return free_slot;
+}
+
+static void sample(void) {
+    uint32_t total;
+    int count = uxTaskGetSystemState(s_status, PROFILER_MAX_TASKS, &total);
+    if (count == 0) {
+        printf("ERROR: profiler: more than %d tasks\n", PROFILER_MAX_TASKS);
+        return;
+    }
+    uint32_t elapsed = total - s_last_total;
+    s_last_total = total;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < PROFILER_MAX_TASKS; i++) s_profiles[i].seen = false;
+    int slot = s_tick % PROFILER_HISTORY;
+    for (int i = 0; i < count; i++) {
+        TaskStatus_t *status = &s_status[i];
+        profile_t *p = find_profile(status->xTaskNumber);
+        if (p == NULL) continue;
+        uint32_t stack_free = sizeof(portSTACK_TYPE) * status->usStackHighWaterMark;
+
+        if (p->number != status->xTaskNumber) {
+            // new task: its run time so far isn't from this second, so start counting at the next one.
+            memset(p, 0, sizeof(*p));
+            p->number = status->xTaskNumber;
+            strncpy(p->name, status->pcTaskName, sizeof(p->name) - 1);
+            for (int j = 0; j < STACK_HISTORY; j++) p->stack_history[j] = stack_free;
+        } else if (s_tick > 0) {
+            uint32_t run = status->ulRunTimeCounter - p->last_run;
+            uint32_t load = elapsed ? (uint32_t) ((uint64_t) run * 1000 / elapsed) : 0;
+            p->load[slot] = load > 1000 ? 1000 : load;
+            if (p->seconds < PROFILER_HISTORY) p->seconds++;
+        }
+        p->last_run = status->ulRunTimeCounter;
+        p->priority = status->uxCurrentPriority;
+        p->state = state_char(status->eCurrentState);
+        p->stack_free = stack_free;
+        if (s_tick % 10 == 0) p->stack_history[(s_tick / 10) % STACK_HISTORY] = stack_free;
+        p->seen = true;
+    }
+    // tasks that are gone
+    for (int i = 0; i < PROFILER_MAX_TASKS; i++) {
+        if (!s_profiles[i].seen) s_profiles[i].number = 0;
+    }
+    s_tick++;
+    xSemaphoreGive(s_lock);
+}
+
+static void profiler_task(void *arg) {
+    TickType_t wake = xTaskGetTickCount();
+    while (true) {
+        sample();
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(1000));
+    }
+}
+
+// average of the newest `window` seconds (or as many as there are), in tenths of a percent
+static uint16_t average(const profile_t *p, int window) {
+    int n = window < p->seconds ? window : p->seconds;
+    if (n == 0) return 0;
+    uint32_t sum = 0;
+    for (int k = 1; k <= n; k++) sum += p->load[(s_tick - k) % PROFILER_HISTORY];
+    return sum / n;
+}
+
+
+// ----- API
+
+int profiler_rows(profiler_row_t *rows, int max) {
+    static const int WINDOWS[3] = { 1, 10, PROFILER_HISTORY };
+    int count = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < PROFILER_MAX_TASKS && count < max; i++) {
+        const profile_t *p = &s_profiles[i];
+        if (p->number == 0) continue;
+        profiler_row_t row;
+        memset(&row, 0, sizeof(row));
+        strncpy(row.name, p->name, sizeof(row.name) - 1);
+        row.number = p->number;
+        row.priority = p->priority;
+        row.state = p->state;
+        for (int w = 0; w < 3; w++) row.load[w] = average(p, WINDOWS[w]);
+        row.stack_free = p->stack_free;
+        // the mark from about a minute ago is the next one to be overwritten
+        uint32_t old = p->stack_history[((s_tick - 1) / 10 + 1) % STACK_HISTORY];
+        row.stack_lost = old > p->stack_free ? old - p->stack_free : 0;
+
+        // insert, busiest first
+        int j = count++;
+        while (j > 0 && rows[j - 1].load[0] < row.load[0]) {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = row;
+    }
+    xSemaphoreGive(s_lock);
+    return count;
+}
+
+void profiler_write_json(profiler_write_t write, void *context) {
+    profiler_row_t *rows = pool_alloc(PROFILER_MAX_TASKS * sizeof(profiler_row_t));
+    if (rows == NULL) {
+        write(context, "[]");
+        return;
+    }
+    int count = profiler_rows(rows, PROFILER_MAX_TASKS);
+
+    char line[192];
+    write(context, "[");
+    for (int i = 0; i < count; i++) {
+        profiler_row_t *r = &rows[i];
+        snprintf(line, sizeof(line),
+            "%s{\"id\":%u,\"name\":\"%s\",\"priority\":%d,\"state\":\"%c\",\"cpu\":[%.1f,%.1f,%.1f],\"stack_free\":%u,\"stack_lost\":%u}",
+            i ? "," : "", r->number, r->name, r->priority, r->state,
+            r->load[0] / 10.0, r->load[1] / 10.0, r->load[2] / 10.0, r->stack_free, r->stack_lost);
+        write(context, line);
+    }
+    write(context, "]");
+    pool_free(rows);
+}
+
+
+// ----- CLI
+
+static void print_rows(const profiler_row_t *rows, int count) {
+    printf("uptime: %lld sec, %d tasks\n", esp_timer_get_time() / 1000000, count);
+    printf("\x1b[4m id name             st pri    1s%%   10s%%   60s%%  xs-stack  lost\x1b[0m\n");
+    for (int i = 0; i < count; i++) {
+        const profiler_row_t *r = &rows[i];
+        printf("%3u %-16s %c %3d", r->number, r->name, r->state, r->priority);
+        for (int w = 0; w < 3; w++) printf(" %4d.%d", r->load[w] / 10, r->load[w] % 10);
+        printf("  %8u %5u\n", r->stack_free, r->stack_lost);
+    }
+}
+
+static void cmd_top(const void *command_arg, int argc, const char * const *argv) {
+    int refreshes = argc > 1 ? atoi(argv[1]) : 1;
+    if (refreshes > TOP_MAX_REFRESHES) refreshes = TOP_MAX_REFRESHES;
+    profiler_row_t *rows = pool_alloc(PROFILER_MAX_TASKS * sizeof(profiler_row_t));
+    if (rows == NULL) {
+        printf("busy, try again\n");
+        return;
+    }
+    for (int i = 0; i < refreshes; i++) {
+        if (i > 0) {
+            cli_sleep(1000);
+            printf("\x1b[H\x1b[2J");
+        }
+        print_rows(rows, profiler_rows(rows, PROFILER_MAX_TASKS));
+    }
+    pool_free(rows);
+}
+
+static cli_command_t commands[] = {
+    { "ps", "show task list, with CPU over the last 1/10/60 seconds", cmd_top, NULL, NULL },
+    { "top [refreshes]", "same as ps, redrawn every second (up to 300)", cmd_top, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+void profiler_init(void) {
+    s_lock = xSemaphoreCreateMutex();
+    TaskHandle_t task;
+    // below the render, output, ddp, and timesync tasks, so sampling never delays a frame. a late sample
+    // is harmless: loads are shares of the time that actually elapsed.
+    xTaskCreate(profiler_task, "profiler", PROFILER_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 2, &task);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * a low-priority task samples FreeRTOS's run-time counters once a second
+ * and keeps a minute of history per task, so `top` can show CPU use over
+ * the last 1, 10, and 60 seconds instead of an average since boot (which
+ * hides a spike from, say, a burst of network traffic). it also watches
+ * each task's stack high-water mark, and how much it dropped over the
+ * last minute.
+ */
+
+#ifndef PROFILER_MAX_TASKS
+#define PROFILER_MAX_TASKS 32
+#endif
+
+// seconds of history (the longest window)
+#define PROFILER_HISTORY 60
+
+#ifndef PROFILER_TASK_STACK_SIZE
+#define PROFILER_TASK_STACK_SIZE 2048
+#endif
+
+typedef struct {
+    char name[16];
+    uint32_t number;
+    uint8_t priority;
+    // R(unning or ready), B(locked), S(uspended), or X
+    char state;
+    // CPU use in tenths of a percent, over the last 1, 10, and 60 seconds
+    uint16_t load[3];
+    // bytes of stack never used, and how much that shrank in the last minute
+    uint32_t stack_free;
+    uint32_t stack_lost;
+} profiler_row_t;
+
+// receives chunks of text, for `profiler_write_json`
+typedef void (*profiler_write_t)(void *context, const char *text);
+
+// start the sampling task, and register CLI commands
+void profiler_init(void);
+
+// copy the latest numbers for up to `max` tasks, busiest (last second) first. returns how many.
+int profiler_rows(profiler_row_t *rows, int max);
+
+// write all tasks as a json array of objects
+void profiler_write_json(profiler_write_t write, void *context);
@@ -0,0 +1,446 @@
+/*
+ * the render task owns the framebuffer: once per frame, it asks each
+ * segment's effect to fill its run of pixels, composites them into the
+ * framebuffer, and sends the result to the strip. if nothing is animated
+ * and nothing has changed, it skips the frame.
+ *
+ * a transition blends from a snapshot of whatever was on the strip to the
+ * live composite over a fixed duration, so changes don't have to snap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "cli.h"
+#include "discovery.h"
+#include "effect.h"
+#include "matrix.h"
+#include "perf.h"
+#include "render.h"
+#include "settings.h"
+#include "source.h"
+#include "timesync.h"
+#include "ws2812b.h"
+
+static nvs_handle_t s_nvs_handle;
+static SemaphoreHandle_t s_lock;
+// given once the first frame is published to the strip
+static SemaphoreHandle_t s_first_frame;
+static bool s_first_frame_sent = false;
+
+// everything below is protected by `s_lock`
+static segment_t s_segments[RENDER_MAX_SEGMENTS];
+static int s_segment_count = 0;
+static int s_pixel_count = RENDER_DEFAULT_PIXELS;
+// if the strip shrank, we need to blank this many pixels on the next frame
+static int s_blank_count = 0;
+static uint8_t s_brightness = 255;
+static bool s_dirty = true;
+static bool s_animated = false;
+// showing a live source's frames (see source.h) instead of the segments
+static bool s_live = false;
+// transition in progress, if `s_fade_duration` > 0
+static uint32_t s_fade_start = 0;
+static uint32_t s_fade_duration = 0;
+static uint8_t s_from[RENDER_MAX_PIXELS * 3];
+
+// written only by the render task, with `s_lock` held
+static uint8_t s_frame[RENDER_MAX_PIXELS * 3];
+static uint8_t s_output[RENDER_MAX_PIXELS * 3];
+static const uint8_t *s_shown = s_frame;
+static uint8_t s_scratch[RENDER_MAX_PIXELS * 3];
+
+
+// stored names are cut to SEGMENT_NAME_SIZE - 1 chars, so a longer name finds the segment it was cut to.
+static int find_segment(const char *name) {
+    for (int i = 0; i < s_segment_count; i++) {
+        if (strncmp(s_segments[i].name, name, SEGMENT_NAME_SIZE - 1) == 0) return i;
+    }
+    return -1;
+}
+
+// NULL if the segment fits on the strip (every pixel it touches is below RENDER_MAX_PIXELS)
+static const char *check_segment(const segment_t *segment) {
+    if (segment->length == 0) return "segment is empty";
+    if (segment->length > RENDER_MAX_PIXELS || segment->start + segment->length > RENDER_MAX_PIXELS) {
+        return "segment runs past RENDER_MAX_PIXELS";
+    }
+    return NULL;
+}
+
+// copy the segments that fit into `s_segments`, returning how many did
+static int copy_segments(const segment_t *segments, int count) {
+    int kept = 0;
+    for (int i = 0; i < count && kept < RENDER_MAX_SEGMENTS; i++) {
+        if (check_segment(&segments[i]) != NULL) continue;
+        s_segments[kept] = segments[i];
+        s_segments[kept].name[SEGMENT_NAME_SIZE - 1] = 0;
+        kept++;
+    }
+    return kept;
+}
+
+static void save_segments(void) {
+    nvs_set_blob(s_nvs_handle, "segments", s_segments, s_segment_count * sizeof(segment_t));
+    nvs_commit(s_nvs_handle);
+}
+
+static void load_segments(void) {
+    s_pixel_count = settings_get_int(SETTING_LED_COUNT);
+    s_brightness = settings_get_int(SETTING_BRIGHTNESS);
+
+    // load into the scratch buffer first, so a bad segment saved by an older build can't get in.
+    segment_t *loaded = (segment_t *) s_scratch;
+    _Static_assert(sizeof(s_scratch) >= sizeof(s_segments), "segments are loaded through s_scratch");
+    size_t len = sizeof(s_segments);
+    if (nvs_get_blob(s_nvs_handle, "segments", loaded, &len) == ESP_OK && len % sizeof(segment_t) == 0) {
+        s_segment_count = copy_segments(loaded, len / sizeof(segment_t));
+    } else {
+        s_segment_count = 0;
+    }
+
+    if (s_segment_count == 0) {
+        // one segment covering the whole strip, dark
+        memset(&s_segments[0], 0, sizeof(segment_t));
+        strcpy(s_segments[0].name, "all");
+        s_segments[0].length = s_pixel_count;
+        s_segment_count = 1;
+    }
+}
+
+
+// ----- compositing
+
+// `map` takes the segment's (logical) pixels to LEDs on the strip
+static void composite_segment(const segment_t *segment, uint32_t t, const uint16_t *map) {
+    int length = segment->length;
+    int span = (segment->flags & SEGMENT_MIRROR) ? (length + 1) / 2 : length;
+    if (span == 0) return;
+    effect_render(segment->effect, segment->color, t, s_scratch, span);
+
+    for (int i = 0; i < length; i++) {
+        int src = (i < span) ? i : length - 1 - i;
+        int dest = segment->start + ((segment->flags & SEGMENT_REVERSE) ? length - 1 - i : i);
+        if (dest >= RENDER_MAX_PIXELS) continue;
+        dest = map[dest];
+        if (dest >= s_pixel_count) continue;
+        if (s_brightness == 255) {
+            memcpy(&s_frame[dest * 3], &s_scratch[src * 3], 3);
+        } else {
+            for (int c = 0; c < 3; c++) s_frame[dest * 3 + c] = effect_scale8(s_scratch[src * 3 + c], s_brightness);
+        }
+    }
+}
+
+// blend from `s_from` toward `s_frame` by `k`/256, into `s_output`
+static void blend_frame(int count, uint32_t k) {
+    for (int i = 0; i < count * 3; i++) {
+        int from = s_from[i];
+        s_output[i] = from + (((s_frame[i] - from) * (int) k) >> 8);
+    }
+}
+
+/*
+ * `t` is the shared network time (msec), so effects line up across devices.
+ * transitions use our local clock, so a sync adjustment can't jerk them.
+ * a live source's frame (`live`, in strip order) replaces the segments entirely.
+ * returns the buffer to send to the strip.
+ */
+static const uint8_t *render_frame(uint32_t t, int count, const uint8_t *live, int live_count) {
+    memset(s_frame, 0, count * 3);
+
+    if (live != NULL) {
+        int n = (live_count < count ? live_count : count) * 3;
+        for (int i = 0; i < n; i++) s_frame[i] = effect_scale8(live[i], s_brightness);
+    } else {
+        s_animated = false;
+        const uint16_t *map = matrix_lock();
+        for (int i = 0; i < s_segment_count; i++) {
+            composite_segment(&s_segments[i], t, map);
+            if (effect_is_animated(s_segments[i].effect)) s_animated = true;
+        }
+        matrix_unlock();
+    }
+
+    if (s_fade_duration == 0) return s_frame;
+    uint32_t elapsed = (uint32_t) (esp_timer_get_time() / 1000) - s_fade_start;
+    if (elapsed >= s_fade_duration) {
+        s_fade_duration = 0;
+        return s_frame;
+    }
+    blend_frame(count, (elapsed << 8) / s_fade_duration);
+    return s_output;
+}
+
+static void render_task(void *arg) {
+    TickType_t wake = xTaskGetTickCount();
+
+    while (true) {
+        int count = 0, live_count = 0;
+        const uint8_t *live = source_frame(&live_count);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        // when the live sources stop, go back to the segments
+        if (s_live && live == NULL) s_dirty = true;
+        s_live = (live != NULL);
+        if (s_dirty || s_animated || s_fade_duration > 0 || s_live) {
+            int64_t start = perf_now();
+            count = s_pixel_count > s_blank_count ? s_pixel_count : s_blank_count;
+            s_shown = render_frame(timesync_now() / 1000, count, live, live_count);
+            perf_timer_record(PERF_TIMER_RENDER, start);
+            s_dirty = false;
+            s_blank_count = 0;
+        }
+        xSemaphoreGive(s_lock);
+
+        // only the render task writes the frame buffers, so it's safe to publish without the lock.
+        if (count > 0) {
+            memcpy(ws2812b_back_buffer(), s_shown, count * 3);
+            ws2812b_publish(count);
+        }
+        if (!s_first_frame_sent) {
+            xSemaphoreGive(s_first_frame);
+            s_first_frame_sent = true;
+        }
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(RENDER_FRAME_MS));
+    }
+}
+
+
+// ----- API
+
+// led count or brightness changed, from here or from `config set`
+static void setting_changed(setting_t setting) {
+    int count = settings_get_int(SETTING_LED_COUNT);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (count < s_pixel_count) s_blank_count = s_pixel_count;
+    bool resized = (count != s_pixel_count);
+    s_pixel_count = count;
+    s_brightness = settings_get_int(SETTING_BRIGHTNESS);
+    s_dirty = true;
+    xSemaphoreGive(s_lock);
+
+    if (resized) discovery_update();
+}
+
+int render_pixel_count(void) {
+    return s_pixel_count;
+}
+
+void render_set_pixel_count(int count) {
+    if (count < 0) count = 0;
+    if (count > RENDER_MAX_PIXELS) count = RENDER_MAX_PIXELS;
+    // `setting_changed` picks it up from here.
+    settings_set_int(SETTING_LED_COUNT, count);
+}
+
+uint8_t render_brightness(void) {
+    return s_brightness;
+}
+
+void render_set_brightness(uint8_t brightness) {
+    settings_set_int(SETTING_BRIGHTNESS, brightness);
+}
+
+void render_redraw(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_dirty = true;
+    xSemaphoreGive(s_lock);
+}
+
+void render_transition(uint32_t ms) {
+    if (ms > RENDER_MAX_TRANSITION_MS) ms = RENDER_MAX_TRANSITION_MS;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    // start from whatever is on the strip now, even if that's the middle of another transition.
+    memcpy(s_from, s_shown, sizeof(s_from));
+    s_fade_start = esp_timer_get_time() / 1000;
+    s_fade_duration = ms;
+    s_dirty = true;
+    xSemaphoreGive(s_lock);
+}
+
+bool render_segment_get(const char *name, segment_t *segment) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int i = find_segment(name);
+    if (i >= 0) *segment = s_segments[i];
+    xSemaphoreGive(s_lock);
+    return i >= 0;
+}
+
+const char *render_segment_put(const segment_t *segment) {
+    const char *error = check_segment(segment);
+    if (error != NULL) return error;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int i = find_segment(segment->name);
+    if (i < 0) {
+        if (s_segment_count == RENDER_MAX_SEGMENTS) {
+            xSemaphoreGive(s_lock);
+            return "too many segments";
+        }
+        i = s_segment_count++;
+    }
+    s_segments[i] = *segment;
+    s_segments[i].name[SEGMENT_NAME_SIZE - 1] = 0;
+    s_dirty = true;
+    save_segments();
+    xSemaphoreGive(s_lock);
+    return NULL;
+}
+
+bool render_segment_remove(const char *name) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int i = find_segment(name);
+    if (i >= 0) {
+        memmove(&s_segments[i], &s_segments[i + 1], (s_segment_count - i - 1) * sizeof(segment_t));
+        s_segment_count--;
+        s_dirty = true;
+        save_segments();
+    }
+    xSemaphoreGive(s_lock);
+    return i >= 0;
+}
+
+void render_segment_replace(const segment_t *segments, int count) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_segment_count = copy_segments(segments, count);
+    s_dirty = true;
+    save_segments();
+    xSemaphoreGive(s_lock);
+}
+
+int render_segment_list(segment_t *segments, int max) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int count = s_segment_count < max ? s_segment_count : max;
+    memcpy(segments, s_segments, count * sizeof(segment_t));
+    xSemaphoreGive(s_lock);
+    return count;
+}
+
+
+// ----- CLI
+
+static void cmd_leds(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2) {
+        printf("leds: %d\n", render_pixel_count());
+        return;
+    }
+    render_set_pixel_count(atoi(argv[1]));
+}
+
+static void cmd_brightness(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2) {
+        printf("brightness: %d\n", render_brightness());
+        return;
+    }
+    if (argc > 2) render_transition(atoi(argv[2]));
+    render_set_brightness(atoi(argv[1]));
+}
+
+static void cmd_seg_list(const void *command_arg, int argc, const char * const *argv) {
+    segment_t segments[RENDER_MAX_SEGMENTS];
+    int count = render_segment_list(segments, RENDER_MAX_SEGMENTS);
+
+    printf("\x1b[4mname         start  len flags effect   color \x1b[0m\n");
+    for (int i = 0; i < count; i++) {
+        segment_t *s = &segments[i];
+        printf("%-12s %5d %4d %c%c    %-8s %06x\n", s->name, s->start, s->length,
+            (s->flags & SEGMENT_REVERSE) ? 'R' : '-', (s->flags & SEGMENT_MIRROR) ? 'M' : '-',
+            effect_name(s->effect), s->color);
+    }
+}
+
+static void cmd_seg_add(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 4) {
+        printf("usage: seg add <name> <start> <length>\n");
+        return;
+    }
+
+    segment_t segment;
+    if (!render_segment_get(argv[1], &segment)) {
+        memset(&segment, 0, sizeof(segment));
+        strncpy(segment.name, argv[1], SEGMENT_NAME_SIZE - 1);
+    }
+    segment.start = atoi(argv[2]);
+    segment.length = atoi(argv[3]);
+    const char *error = render_segment_put(&segment);
+    if (error != NULL) printf("%s\n", error);
+}
+
+static void cmd_seg_del(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2 || !render_segment_remove(argv[1])) printf("no such segment\n");
+}
+
+// shared by color/effect/flip/mirror: argv[1] is the segment, argv[2] is the new value, and argv[3] is an optional fade time
+static void cmd_seg_modify(const void *command_arg, int argc, const char * const *argv) {
+    segment_t segment;
+    if (argc < 3) {
+        printf("usage: seg %s <name> <value>\n", argv[0]);
+        return;
+    }
+    if (!render_segment_get(argv[1], &segment)) {
+        printf("no such segment\n");
+        return;
+    }
+
+    if (strcmp(argv[0], "color") == 0) {
+        segment.color = strtoul(argv[2], NULL, 16) & 0xffffff;
+    } else if (strcmp(argv[0], "effect") == 0) {
+        int effect = effect_find(argv[2]);
+        if (effect < 0) {
+            printf("effects:");
+            for (int i = 0; i < EFFECT_COUNT; i++) printf(" %s", effect_name(i));
+            printf("\n");
+            return;
+        }
+        segment.effect = effect;
+    } else {
+        uint8_t flag = (strcmp(argv[0], "flip") == 0) ? SEGMENT_REVERSE : SEGMENT_MIRROR;
+        segment.flags = cli_is_truthy(argv[2]) ? (segment.flags | flag) : (segment.flags & ~flag);
+    }
+    if (argc > 3) render_transition(atoi(argv[3]));
+    const char *error = render_segment_put(&segment);
+    if (error != NULL) printf("%s\n", error);
+}
+
+static cli_command_t seg_commands[] = {
+    { "list", "show segments", cmd_seg_list, NULL, NULL },
+    { "add <name> <start> <length>", "add or move a segment", cmd_seg_add, NULL, NULL },
+    { "del <name>", "remove a segment", cmd_seg_del, NULL, NULL },
+    { "color <name> <rrggbb> [ms]", "set segment color", cmd_seg_modify, NULL, NULL },
+    { "effect <name> <effect> [ms]", "set segment effect", cmd_seg_modify, NULL, NULL },
+    { "flip <name> <on|off>", "run segment backwards", cmd_seg_modify, NULL, NULL },
+    { "mirror <name> <on|off>", "reflect segment around its center", cmd_seg_modify, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "leds <count>", "show/set number of leds on the strip", cmd_leds, NULL, NULL },
+    { "brightness <0-255> [ms]", "show/set overall brightness", cmd_brightness, NULL, NULL },
+    { "seg", NULL, NULL, NULL, seg_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void render_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    s_lock = xSemaphoreCreateMutex();
+    load_segments();
+    settings_watch(SETTING_LED_COUNT, setting_changed);
+    settings_watch(SETTING_BRIGHTNESS, setting_changed);
+    printf("render_init: %d pixels, %d segments\n", s_pixel_count, s_segment_count);
+    cli_register_commands(commands);
+}
+
+void render_start(void) {
+    s_first_frame = xSemaphoreCreateBinary();
+
+    TaskHandle_t task;
+    xTaskCreate(render_task, "render", RENDER_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 5, &task);
+
+    // a frame of 300 pixels takes about 10ms to send, so this should never time out.
+    xSemaphoreTake(s_first_frame, pdMS_TO_TICKS(100));
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nvs_flash.h"
+
+// most pixels we'll ever drive on the one strip
+#ifndef RENDER_MAX_PIXELS
+#define RENDER_MAX_PIXELS 300
+#endif
+
+// pixel count until someone configures it
+#ifndef RENDER_DEFAULT_PIXELS
+#define RENDER_DEFAULT_PIXELS 16
+#endif
+
+#ifndef RENDER_MAX_SEGMENTS
+#define RENDER_MAX_SEGMENTS 8
+#endif
+
+// frame period of the render task (FREERTOS_HZ is 100, so keep this a multiple of 10)
+#ifndef RENDER_FRAME_MS
+#define RENDER_FRAME_MS 20
+#endif
+
+// longest transition we'll honor
+#ifndef RENDER_MAX_TRANSITION_MS
+#define RENDER_MAX_TRANSITION_MS 60000
+#endif
+
+#ifndef RENDER_TASK_STACK_SIZE
+#define RENDER_TASK_STACK_SIZE 3072
+#endif
+
+#define SEGMENT_NAME_SIZE 12
+
+// the segment's pixels run backwards from the end
+#define SEGMENT_REVERSE 0x01
+// the effect covers the first half, and the second half is a reflection of it
+#define SEGMENT_MIRROR 0x02
+
+/*
+ * a named run of pixels on the strip, with its own effect and color.
+ * segments are composited in order, so a later segment wins where they
+ * overlap. this struct is persisted to NVS as-is.
+ */
+typedef struct {
+    char name[SEGMENT_NAME_SIZE];
+    uint16_t start;
+    uint16_t length;
+    uint8_t flags;
+    uint8_t effect;
+    uint32_t color;
+} segment_t;
+
+// load the pixel count, brightness, and segments from NVS.
+void render_init(nvs_handle_t nvs_handle);
+
+/*
+ * start the render task, and wait for it to send the first frame.
+ * the LED driver must be initialized first. anything that changes the
+ * boot-time state (like a preset) should happen before this, so the first
+ * frame is the right one.
+ */
+void render_start(void);
+
+int render_pixel_count(void);
+void render_set_pixel_count(int count);
+
+uint8_t render_brightness(void);
+void render_set_brightness(uint8_t brightness);
+
+// redraw on the next frame, after something effects depend on (like the pixel map) changed.
+void render_redraw(void);
+
+/*
+ * fade from the current contents of the strip to whatever is composited
+ * next, over `ms` msec. call this right before making a change.
+ */
+void render_transition(uint32_t ms);
+
+// copy out the named segment. returns false if there isn't one.
+bool render_segment_get(const char *name, segment_t *segment);
+
+/*
+ * add or replace a segment (by name) and persist the table. returns NULL,
+ * or what's wrong (like a segment that runs off the end of RENDER_MAX_PIXELS).
+ */
+const char *render_segment_put(const segment_t *segment);
+
+// remove a segment and persist the table. returns false if there wasn't one.
+bool render_segment_remove(const char *name);
+
+// replace the whole segment table and persist it. segments that don't fit are dropped.
+void render_segment_replace(const segment_t *segments, int count);
+
+// copy out up to `max` segments, returning how many were copied.
+int render_segment_list(segment_t *segments, int max);
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "cli.h"
+#include "matrix.h"
+#include "render.h"
+#include "settings.h"
+#include "wifi.h"
+
+typedef enum {
+    TYPE_STR = 0,
+    TYPE_U8,
+    TYPE_U16,
+    TYPE_U32,
+    // stored as a u8, but read & written as one of `choices`
+    TYPE_ENUM,
+} type_t;
+
+typedef struct {
+    // also the NVS key
+    const char *key;
+    type_t type;
+    // range for numbers, or max length for strings
+    uint32_t min;
+    uint32_t max;
+    uint32_t default_int;
+    const char *default_str;
+    const char * const *choices;
+    bool secret;
+} setting_info_t;
+
+static const char * const PS_POLICIES[] = { "auto", "latency", "power", NULL };
+static const char * const MATRIX_LAYOUTS[] = { "rows", "serpentine", "custom", NULL };
+static const char * const MATRIX_ROTATIONS[] = { "0", "90", "180", "270", NULL };
+static const char * const OFF_ON[] = { "off", "on", NULL };
+
+static const setting_info_t SETTINGS[SETTING_COUNT] = {
+    [SETTING_NAME] = { "name", TYPE_STR, 1, 63, 0, "default-name", NULL, false },
+    [SETTING_WIFI_SSID] = { "wifi-ssid", TYPE_STR, 0, 32, 0, "none", NULL, false },
+    [SETTING_WIFI_PASS] = { "wifi-pass", TYPE_STR, 0, 64, 0, "none", NULL, true },
+    [SETTING_LED_COUNT] = { "led-count", TYPE_U16, 0, RENDER_MAX_PIXELS, RENDER_DEFAULT_PIXELS, NULL, NULL, false },
+    [SETTING_BRIGHTNESS] = { "brightness", TYPE_U8, 0, 255, 255, NULL, NULL, false },
+    [SETTING_WIFI_PS] = { "wifi-ps", TYPE_ENUM, WIFI_PS_POLICY_AUTO, WIFI_PS_POLICY_POWER, WIFI_PS_POLICY_AUTO, NULL, PS_POLICIES, false },
+    [SETTING_WIFI_PS_IDLE] = { "wifi-ps-idle", TYPE_U32, 0, 3600000, 10000, NULL, NULL, false },
+    [SETTING_MATRIX_WIDTH] = { "matrix-width", TYPE_U16, 0, RENDER_MAX_PIXELS, 0, NULL, NULL, false },
+    [SETTING_MATRIX_HEIGHT] = { "matrix-height", TYPE_U16, 0, RENDER_MAX_PIXELS, 0, NULL, NULL, false },
+    [SETTING_MATRIX_LAYOUT] = { "matrix-layout", TYPE_ENUM, MATRIX_ROWS, MATRIX_CUSTOM, MATRIX_ROWS, NULL, MATRIX_LAYOUTS, false },
+    [SETTING_MATRIX_ROTATE] = { "matrix-rotate", TYPE_ENUM, MATRIX_ROTATE_0, MATRIX_ROTATE_270, MATRIX_ROTATE_0, NULL, MATRIX_ROTATIONS, false },
+    [SETTING_AUDIO] = { "audio", TYPE_ENUM, 0, 1, 0, NULL, OFF_ON, false },
+};
+
+static nvs_handle_t s_nvs_handle;
+static SemaphoreHandle_t s_lock;
+static esp_timer_handle_t s_commit_timer;
+
+// protected by `s_lock`
+static uint32_t s_numbers[SETTING_COUNT];
+static char *s_strings[SETTING_COUNT];
+// bitmask of settings that haven't been written to NVS yet
+static uint32_t s_unsaved = 0;
+
+static struct {
+    setting_t setting;
+    settings_watcher_t watcher;
+} s_watchers[SETTINGS_MAX_WATCHERS];
+static int s_watcher_count = 0;
+
+
+static void load(setting_t setting) {
+    const setting_info_t *info = &SETTINGS[setting];
+    if (info->type == TYPE_STR) {
+        s_strings[setting] = malloc(SETTINGS_STR_SIZE);
+        size_t len = SETTINGS_STR_SIZE;
+        if (nvs_get_str(s_nvs_handle, info->key, s_strings[setting], &len) != ESP_OK) strcpy(s_strings[setting], info->default_str);
+        return;
+    }
+
+    esp_err_t err = ESP_FAIL;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    switch (info->type) {
+        case TYPE_U8:
+        case TYPE_ENUM:
+            err = nvs_get_u8(s_nvs_handle, info->key, &u8);
+            u32 = u8;
+            break;
+        case TYPE_U16:
+            err = nvs_get_u16(s_nvs_handle, info->key, &u16);
+            u32 = u16;
+            break;
+        default:
+            err = nvs_get_u32(s_nvs_handle, info->key, &u32);
+            break;
+    }
+    // something out of range must be from an older build.
+    if (err != ESP_OK || u32 < info->min || u32 > info->max) u32 = info->default_int;
+    s_numbers[setting] = u32;
+}
+
+static void save(setting_t setting) {
+    const setting_info_t *info = &SETTINGS[setting];
+    switch (info->type) {
+        case TYPE_STR:
+            nvs_set_str(s_nvs_handle, info->key, s_strings[setting]);
+            break;
+        case TYPE_U8:
+        case TYPE_ENUM:
+            nvs_set_u8(s_nvs_handle, info->key, s_numbers[setting]);
+            break;
+        case TYPE_U16:
+            nvs_set_u16(s_nvs_handle, info->key, s_numbers[setting]);
+            break;
+        case TYPE_U32:
+            nvs_set_u32(s_nvs_handle, info->key, s_numbers[setting]);
+            break;
+    }
+}
+
+static void commit_callback(void *arg) {
+    settings_flush();
+}
+
+// call watchers and schedule a commit, after a change. (`s_lock` must not be held.)
+static void changed(setting_t setting) {
+    for (int i = 0; i < s_watcher_count; i++) {
+        if (s_watchers[i].setting == setting) s_watchers[i].watcher(setting);
+    }
+    // if a commit is already scheduled, this change will go out with it.
+    esp_timer_start_once(s_commit_timer, SETTINGS_COMMIT_DELAY_MS * 1000);
+}
+
+static void format(setting_t setting, char *buffer, size_t size) {
+    const setting_info_t *info = &SETTINGS[setting];
+    if (info->type == TYPE_STR) {
+        settings_get_str(setting, buffer, size);
+    } else if (info->type == TYPE_ENUM) {
+        snprintf(buffer, size, "%s", info->choices[settings_get_int(setting)]);
+    } else {
+        snprintf(buffer, size, "%u", settings_get_int(setting));
+    }
+}
+
+
+// ----- API
+
+int settings_find(const char *key) {
+    for (int i = 0; i < SETTING_COUNT; i++) if (strcmp(key, SETTINGS[i].key) == 0) return i;
+    return -1;
+}
+
+const char *settings_key(setting_t setting) {
+    return SETTINGS[setting].key;
+}
+
+uint32_t settings_get_int(setting_t setting) {
+    return s_numbers[setting];
+}
+
+void settings_get_str(setting_t setting, char *buffer, size_t size) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    strlcpy(buffer, s_strings[setting], size);
+    xSemaphoreGive(s_lock);
+}
+
+bool settings_set_int(setting_t setting, uint32_t value) {
+    const setting_info_t *info = &SETTINGS[setting];
+    if (info->type == TYPE_STR || value < info->min || value > info->max) return false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool is_changed = (s_numbers[setting] != value);
+    s_numbers[setting] = value;
+    if (is_changed) s_unsaved |= (1 << setting);
+    xSemaphoreGive(s_lock);
+
+    if (is_changed) changed(setting);
+    return true;
+}
+
+bool settings_set_str(setting_t setting, const char *value) {
+    const setting_info_t *info = &SETTINGS[setting];
+    size_t len = strlen(value);
+    if (info->type != TYPE_STR || len < info->min || len > info->max) return false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool is_changed = (strcmp(s_strings[setting], value) != 0);
+    strcpy(s_strings[setting], value);
+    if (is_changed) s_unsaved |= (1 << setting);
+    xSemaphoreGive(s_lock);
+
+    if (is_changed) changed(setting);
+    return true;
+}
+
+bool settings_set(setting_t setting, const char *value) {
+    const setting_info_t *info = &SETTINGS[setting];
+    if (info->type == TYPE_STR) return settings_set_str(setting, value);
+    if (info->type == TYPE_ENUM) {
+        for (int i = 0; info->choices[i] != NULL; i++) {
+            if (strcmp(value, info->choices[i]) == 0) return settings_set_int(setting, i);
+        }
+        return false;
+    }
+
+    char *end;
+    uint32_t n = strtoul(value, &end, 0);
+    if (*value == 0 || *end != 0) return false;
+    return settings_set_int(setting, n);
+}
+
+void settings_watch(setting_t setting, settings_watcher_t watcher) {
+    if (s_watcher_count == SETTINGS_MAX_WATCHERS) {
+        printf("!!! too many settings watchers; increase SETTINGS_MAX_WATCHERS\n");
+        return;
+    }
+    s_watchers[s_watcher_count].setting = setting;
+    s_watchers[s_watcher_count].watcher = watcher;
+    s_watcher_count++;
+}
+
+void settings_flush(void) {
+    esp_timer_stop(s_commit_timer);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_unsaved != 0) {
+        for (int i = 0; i < SETTING_COUNT; i++) if (s_unsaved & (1 << i)) save(i);
+        nvs_commit(s_nvs_handle);
+        s_unsaved = 0;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void settings_write_json(settings_write_t write, void *context) {
+    char value[SETTINGS_STR_SIZE];
+    // worst case, every char of the value is escaped
+    char line[SETTINGS_STR_SIZE * 2 + 32];
+
+    bool first = true;
+    write(context, "{");
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        const setting_info_t *info = &SETTINGS[i];
+        if (info->secret) continue;
+        format(i, value, sizeof(value));
+
+        char *p = line;
+        p += sprintf(p, "%s\"%s\":", first ? "" : ",", info->key);
+        first = false;
+        if (info->type == TYPE_STR || info->type == TYPE_ENUM) {
+            *p++ = '"';
+            for (const char *v = value; *v; v++) {
+                if (*v == '"' || *v == '\\') *p++ = '\\';
+                *p++ = *v;
+            }
+            *p++ = '"';
+        } else {
+            p += sprintf(p, "%s", value);
+        }
+        *p = 0;
+        write(context, line);
+    }
+    write(context, "}");
+}
+
+
+// ----- CLI
+
+// the CLI is reachable over the network, so it only admits whether a secret is set.
+static void format_visible(setting_t setting, char *value, size_t size) {
+    format(setting, value, size);
+    if (SETTINGS[setting].secret && value[0]) strlcpy(value, "(hidden)", size);
+}
+
+static void cmd_config_list(const void *command_arg, int argc, const char * const *argv) {
+    char value[SETTINGS_STR_SIZE];
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        format_visible(i, value, sizeof(value));
+        printf("%-14s %s\n", SETTINGS[i].key, value);
+    }
+    if (s_unsaved) printf("(unsaved changes)\n");
+}
+
+static void cmd_config_get(const void *command_arg, int argc, const char * const *argv) {
+    int setting = argc < 2 ? -1 : settings_find(argv[1]);
+    if (setting < 0) {
+        printf("no such setting\n");
+        return;
+    }
+    char value[SETTINGS_STR_SIZE];
+    format_visible(setting, value, sizeof(value));
+    printf("%s\n", value);
+}
+
+static void cmd_config_set(const void *command_arg, int argc, const char * const *argv) {
+    int setting = argc < 3 ? -1 : settings_find(argv[1]);
+    if (setting < 0) {
+        printf("usage: config set <key> <value>\n");
+        return;
+    }
+    // values (like an ssid) can have spaces
+    char value[SETTINGS_STR_SIZE];
+    value[0] = 0;
+    for (int i = 2; i < argc; i++) {
+        if (i > 2) strlcat(value, " ", sizeof(value));
+        strlcat(value, argv[i], sizeof(value));
+    }
+    if (!settings_set(setting, value)) {
+        const setting_info_t *info = &SETTINGS[setting];
+        if (info->type == TYPE_STR) {
+            printf("%s must be %u to %u chars\n", info->key, info->min, info->max);
+        } else if (info->type == TYPE_ENUM) {
+            printf("%s must be one of:", info->key);
+            for (int i = 0; info->choices[i] != NULL; i++) printf(" %s", info->choices[i]);
+            printf("\n");
+        } else {
+            printf("%s must be %u to %u\n", info->key, info->min, info->max);
+        }
+    }
+}
+
+static void cmd_config_save(const void *command_arg, int argc, const char * const *argv) {
+    settings_flush();
+}
+
+static cli_command_t config_commands[] = {
+    { "list", "show all settings", cmd_config_list, NULL, NULL },
+    { "get <key>", "show one setting", cmd_config_get, NULL, NULL },
+    { "set <key> <value>", "change a setting", cmd_config_set, NULL, NULL },
+    { "save", "write unsaved changes now", cmd_config_save, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "config", NULL, NULL, NULL, config_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void settings_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    s_lock = xSemaphoreCreateMutex();
+    for (int i = 0; i < SETTING_COUNT; i++) load(i);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = commit_callback,
+        .name = "settings",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_commit_timer));
+    cli_register_commands(commands);
+}
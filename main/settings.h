@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nvs_flash.h"
+
+/*
+ * every user-facing config value lives here: loaded from NVS once at boot
+ * and kept in RAM. a change takes effect (and calls any watchers) right
+ * away, but it's written back to NVS lazily, so a burst of changes -- like
+ * dragging a brightness slider -- turns into one flash write.
+ */
+
+// how long after the first unsaved change to write everything back
+#ifndef SETTINGS_COMMIT_DELAY_MS
+#define SETTINGS_COMMIT_DELAY_MS 2000
+#endif
+
+// string settings hold at most this many chars, plus the terminating 0
+#define SETTINGS_STR_SIZE 65
+
+#ifndef SETTINGS_MAX_WATCHERS
+#define SETTINGS_MAX_WATCHERS 16
+#endif
+
+typedef enum {
+    SETTING_NAME = 0,
+    SETTING_WIFI_SSID,
+    SETTING_WIFI_PASS,
+    SETTING_LED_COUNT,
+    SETTING_BRIGHTNESS,
+    SETTING_WIFI_PS,
+    SETTING_WIFI_PS_IDLE,
+    SETTING_MATRIX_WIDTH,
+    SETTING_MATRIX_HEIGHT,
+    SETTING_MATRIX_LAYOUT,
+    SETTING_MATRIX_ROTATE,
+    SETTING_AUDIO,
+    SETTING_COUNT,
+} setting_t;
+
+// called (on the task that made the change) after a setting changes value
+typedef void (*settings_watcher_t)(setting_t setting);
+
+// receives chunks of text, for `settings_write_json`
+typedef void (*settings_write_t)(void *context, const char *text);
+
+// load everything from NVS and register CLI commands. call this before anything reads a setting.
+void settings_init(nvs_handle_t nvs_handle);
+
+// find a setting by its key (like "wifi-ssid"), or -1
+int settings_find(const char *key);
+
+const char *settings_key(setting_t setting);
+
+uint32_t settings_get_int(setting_t setting);
+void settings_get_str(setting_t setting, char *buffer, size_t size);
+
+/*
+ * change a setting. returns false (and changes nothing) if the value is
+ * out of range or too long for the setting.
+ */
+bool settings_set_int(setting_t setting, uint32_t value);
+bool settings_set_str(setting_t setting, const char *value);
+
+// change a setting of any type, from its text form (for the CLI & HTTP).
+bool settings_set(setting_t setting, const char *value);
+
+void settings_watch(setting_t setting, settings_watcher_t watcher);
+
+// write any unsaved changes now (like before a reboot).
+void settings_flush(void);
+
+// write all settings as a json object. secrets (the wifi password) are left out.
+void settings_write_json(settings_write_t write, void *context);
@@ -0,0 +1,176 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "cli.h"
+#include "render.h"
+#include "source.h"
+#include "trace.h"
+
+typedef struct {
+    const char *name;
+    // for the trace, when it takes over
+    const char *trace_name;
+    uint8_t priority;
+    uint32_t hold_ms;
+
+    framebuf_t frames;
+    // when the newest frame was published (msec)
+    volatile uint32_t frame_time;
+    // published since the last release
+    volatile bool held;
+
+    // only touched by the render task
+    const uint8_t *front;
+    int front_size;
+    uint32_t wins;
+} source_info_t;
+
+static source_info_t s_sources[SOURCE_COUNT] = {
+    [SOURCE_DDP] = { "ddp", "source: ddp", SOURCE_DDP_PRIORITY, SOURCE_DDP_HOLD_MS },
+    [SOURCE_HTTP] = { "http", "source: http", SOURCE_HTTP_PRIORITY, SOURCE_HTTP_HOLD_MS },
+    [SOURCE_CLI] = { "cli", "source: cli", SOURCE_CLI_PRIORITY, SOURCE_CLI_HOLD_MS },
+};
+
+// only touched by the render task
+static int s_active = SOURCE_NONE;
+
+
+static uint32_t now_ms(void) {
+    return esp_timer_get_time() / 1000;
+}
+
+static bool is_holding(const source_info_t *s, uint32_t now) {
+    if (!s->held || s->front == NULL) return false;
+    // signed, since a source can publish after `now` was read, which would look like a frame from ages ago.
+    return s->hold_ms == 0 || (int32_t) (now - s->frame_time) <= (int32_t) s->hold_ms;
+}
+
+
+// ----- API
+
+const char *source_name(source_t source) {
+    return s_sources[source].name;
+}
+
+uint8_t *source_back(source_t source) {
+    return framebuf_back(&s_sources[source].frames);
+}
+
+void source_publish(source_t source, int size) {
+    source_info_t *s = &s_sources[source];
+    framebuf_publish(&s->frames, size);
+    s->frame_time = now_ms();
+    s->held = true;
+}
+
+void source_release(source_t source) {
+    s_sources[source].held = false;
+}
+
+const uint8_t *source_frame(int *count) {
+    int best = SOURCE_NONE;
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        source_info_t *s = &s_sources[i];
+        // take new frames even from sources that are losing, so a stale one never shows when they win.
+        int size;
+        const uint8_t *frame = framebuf_take(&s->frames, &size);
+        if (frame != NULL) {
+            s->front = frame;
+            s->front_size = size;
+        }
+        if (!is_holding(s, now_ms())) continue;
+        if (
+            best == SOURCE_NONE ||
+            s->priority > s_sources[best].priority ||
+            (s->priority == s_sources[best].priority && (int32_t) (s->frame_time - s_sources[best].frame_time) > 0)
+        ) best = i;
+    }
+
+    if (best != s_active) {
+        trace_instant(best == SOURCE_NONE ? "source: effects" : s_sources[best].trace_name);
+        s_active = best;
+    }
+    if (best == SOURCE_NONE) return NULL;
+    s_sources[best].wins++;
+    *count = s_sources[best].front_size / 3;
+    return s_sources[best].front;
+}
+
+int source_active(void) {
+    return s_active;
+}
+
+const framebuf_t *source_frames(source_t source) {
+    return &s_sources[source].frames;
+}
+
+
+// ----- CLI
+
+static int find_source(const char *name) {
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        if (strcmp(s_sources[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static void cmd_source(const void *command_arg, int argc, const char * const *argv) {
+    if (argc > 2) {
+        int i = find_source(argv[1]);
+        if (i < 0) {
+            printf("sources: ddp http cli\n");
+            return;
+        }
+        s_sources[i].priority = atoi(argv[2]);
+        if (argc > 3) s_sources[i].hold_ms = atoi(argv[3]);
+    }
+
+    uint32_t now = now_ms();
+    int active = s_active;
+    printf("showing: %s\n", active == SOURCE_NONE ? "effects" : s_sources[active].name);
+    printf("\x1b[4msource pri  hold ms  state      frames    shown\x1b[0m\n");
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        source_info_t *s = &s_sources[i];
+        const char *state = (i == active) ? "active" : is_holding(s, now) ? "outranked" : "idle";
+        printf("%-6s %3d %8u  %-9s %7u %8u\n", s->name, s->priority, s->hold_ms, state, s->frames.published, s->wins);
+    }
+}
+
+// frame <rrggbb> [rrggbb...] -- one color per pixel, and the last one fills the rest of the strip
+static void cmd_frame(const void *command_arg, int argc, const char * const *argv) {
+    if (argc < 2) {
+        printf("usage: frame <rrggbb...> | frame off\n");
+        return;
+    }
+    if (strcmp(argv[1], "off") == 0) {
+        source_release(SOURCE_CLI);
+        return;
+    }
+
+    // CLI commands run one at a time, so this is the only producer.
+    uint8_t *back = source_back(SOURCE_CLI);
+    int count = render_pixel_count();
+    uint32_t color = 0;
+    for (int i = 0; i < count; i++) {
+        if (i + 1 < argc) color = strtoul(argv[i + 1], NULL, 16);
+        back[i * 3] = color >> 16;
+        back[i * 3 + 1] = color >> 8;
+        back[i * 3 + 2] = color;
+    }
+    source_publish(SOURCE_CLI, count * 3);
+}
+
+static cli_command_t commands[] = {
+    { "source [<name> <priority> [hold-ms]]", "show who owns the strip, or change a source's priority", cmd_source, NULL, NULL },
+    { "frame <rrggbb...>|off", "take over the strip with fixed colors, or let go", cmd_frame, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+void source_init(void) {
+    for (int i = 0; i < SOURCE_COUNT; i++) framebuf_init(&s_sources[i].frames);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include "framebuf.h"
+
+/*
+ * who owns the strip. the effects (segments, presets, /set) are always
+ * there underneath; on top of them, each live source can push whole
+ * frames. every frame, the render task shows the highest-priority source
+ * that's holding the strip (ties go to whichever sent a frame most
+ * recently), or the effects if none is. a source holds the strip from its
+ * first frame until it's released, or until `hold` msec pass without a new
+ * frame (0 = no timeout). the effects come back on the very next frame.
+ *
+ * each source gets its own triple buffer (see framebuf.h), so exactly one
+ * task may produce frames for it.
+ */
+
+typedef enum {
+    // UDP realtime frames (ddp.c)
+    SOURCE_DDP = 0,
+    // POST /frame
+    SOURCE_HTTP,
+    // the `frame` command
+    SOURCE_CLI,
+    SOURCE_COUNT,
+} source_t;
+
+// what `source_active` returns when the effects are showing
+#define SOURCE_NONE (-1)
+
+#ifndef SOURCE_DDP_PRIORITY
+#define SOURCE_DDP_PRIORITY 2
+#endif
+#ifndef SOURCE_DDP_HOLD_MS
+#define SOURCE_DDP_HOLD_MS 2500
+#endif
+
+#ifndef SOURCE_HTTP_PRIORITY
+#define SOURCE_HTTP_PRIORITY 1
+#endif
+#ifndef SOURCE_HTTP_HOLD_MS
+#define SOURCE_HTTP_HOLD_MS 5000
+#endif
+
+// someone at the CLI is probably debugging, so they win
+#ifndef SOURCE_CLI_PRIORITY
+#define SOURCE_CLI_PRIORITY 3
+#endif
+#ifndef SOURCE_CLI_HOLD_MS
+#define SOURCE_CLI_HOLD_MS 30000
+#endif
+
+// register CLI commands
+void source_init(void);
+
+const char *source_name(source_t source);
+
+// producer: the buffer to fill with packed RGB, in strip order
+uint8_t *source_back(source_t source);
+// producer: show the back buffer (its first `size` bytes), and hold the strip
+void source_publish(source_t source, int size);
+// stop holding the strip
+void source_release(source_t source);
+
+/*
+ * for the render task only: the winning source's newest frame, or NULL if
+ * the effects should show. `count` is in pixels.
+ */
+const uint8_t *source_frame(int *count);
+
+// the source that won the last `source_frame`, or SOURCE_NONE
+int source_active(void);
+
+// the source's exchange, for its counters
+const framebuf_t *source_frames(source_t source);
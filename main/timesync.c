@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "cli.h"
+#include "clocksync.h"
+#include "timesync.h"
+#include "wifi.h"
+
+// network time - local time, for every other task. (the sync task's copy is in `s_sync`.)
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_offset = 0;
+
+// everything below is only touched by the sync task
+static clocksync_t s_sync;
+static struct sockaddr_in s_leader_addr;
+
+
+static int64_t to_network_time(int64_t local) {
+    portENTER_CRITICAL(&s_lock);
+    int64_t offset = s_offset;
+    portEXIT_CRITICAL(&s_lock);
+    return local + offset;
+}
+
+int64_t timesync_now(void) {
+    return to_network_time(esp_timer_get_time());
+}
+
+static void send_packet(int sock, uint8_t type, const struct sockaddr_in *addr, int64_t t1, int64_t t2) {
+    clocksync_packet_t packet = {
+        .magic = CLOCKSYNC_MAGIC,
+        .type = type,
+        .id = s_sync.id,
+        .t1 = t1,
+        .t2 = t2,
+    };
+    packet.t3 = (type == CLOCKSYNC_REQUEST) ? 0 : timesync_now();
+    sendto(sock, &packet, sizeof(packet), 0, (const struct sockaddr *) addr, sizeof(*addr));
+}
+
+static void handle_response(const clocksync_packet_t *packet, int64_t t4) {
+    int64_t offset = clocksync_response(&s_sync, packet, t4);
+    portENTER_CRITICAL(&s_lock);
+    s_offset = offset;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static int open_socket(void) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) return -1;
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(TIMESYNC_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct ip_mreq mreq = {
+        .imr_multiaddr.s_addr = inet_addr(TIMESYNC_GROUP),
+        .imr_interface.s_addr = htonl(INADDR_ANY),
+    };
+    uint8_t ttl = 1;
+    if (
+        bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0
+    ) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void timesync_task(void *arg) {
+    int sock = -1;
+    while (sock < 0) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (wifi_is_online()) sock = open_socket();
+    }
+
+    struct sockaddr_in group = {
+        .sin_family = AF_INET,
+        .sin_port = htons(TIMESYNC_PORT),
+        .sin_addr.s_addr = inet_addr(TIMESYNC_GROUP),
+    };
+    int64_t next_announce = 0, next_poll = 0;
+
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        if (now >= next_announce) {
+            send_packet(sock, CLOCKSYNC_ANNOUNCE, &group, 0, 0);
+            next_announce = now + CLOCKSYNC_ANNOUNCE_MS * 1000;
+        }
+        if (clocksync_check_leader(&s_sync, now)) {
+            next_poll = next_announce;
+        } else if (now >= next_poll) {
+            send_packet(sock, CLOCKSYNC_REQUEST, &s_leader_addr, now, 0);
+            next_poll = now + (s_sync.sample_count < CLOCKSYNC_SAMPLES ? CLOCKSYNC_FAST_POLL_MS : CLOCKSYNC_POLL_MS) * 1000;
+        }
+
+        int64_t wait = (next_poll < next_announce ? next_poll : next_announce) - now;
+        if (wait < 0) wait = 0;
+        struct timeval tv = { .tv_sec = wait / 1000000, .tv_usec = wait % 1000000 };
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        if (select(sock + 1, &fds, NULL, NULL, &tv) <= 0) continue;
+
+        clocksync_packet_t packet;
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(sock, &packet, sizeof(packet), 0, (struct sockaddr *) &from, &from_len);
+        int64_t received = esp_timer_get_time();
+        if (len != sizeof(packet) || packet.magic != CLOCKSYNC_MAGIC || packet.id == s_sync.id) continue;
+
+        switch (packet.type) {
+            case CLOCKSYNC_ANNOUNCE:
+                if (clocksync_announce(&s_sync, packet.id, received)) s_leader_addr = from;
+                break;
+            case CLOCKSYNC_REQUEST:
+                send_packet(sock, CLOCKSYNC_RESPONSE, &from, packet.t1, to_network_time(received));
+                break;
+            case CLOCKSYNC_RESPONSE:
+                handle_response(&packet, received);
+                break;
+        }
+    }
+}
+
+
+// ----- CLI
+
+static void cmd_sync(const void *command_arg, int argc, const char * const *argv) {
+    portENTER_CRITICAL(&s_lock);
+    int64_t offset = s_offset;
+    portEXIT_CRITICAL(&s_lock);
+    bool leader = clocksync_is_leader(&s_sync, esp_timer_get_time());
+    printf("id: %016llx (%s)\n", s_sync.id, leader ? "leader" : "follower");
+    if (!leader) printf("leader: %016llx at %s\n", s_sync.leader_id, inet_ntoa(s_leader_addr.sin_addr));
+    printf("offset: %lld us, last rtt: %lld us, samples: %d, responses: %u\n", offset, s_sync.last_rtt, s_sync.sample_count, s_sync.responses);
+}
+
+static cli_command_t commands[] = {
+    { "sync", "show clock sync status", cmd_sync, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+void timesync_init(void) {
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    uint64_t id = 0;
+    for (int i = 0; i < 6; i++) id = (id << 8) | mac[i];
+    clocksync_init(&s_sync, id);
+
+    TaskHandle_t task;
+    xTaskCreate(timesync_task, "timesync", TIMESYNC_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 3, &task);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * keep a shared clock across every glowball on the network, so effects
+ * computed from the time line up between devices.
+ *
+ * every device multicasts an announcement once a second, and the one with
+ * the lowest id (from its MAC) is the leader. everyone else polls the
+ * leader NTP-style, and keeps the offset from the sample with the lowest
+ * round-trip time out of the last few.
+ */
+
+#ifndef TIMESYNC_PORT
+#define TIMESYNC_PORT 4049
+#endif
+
+#ifndef TIMESYNC_GROUP
+#define TIMESYNC_GROUP "239.255.71.66"
+#endif
+
+#ifndef TIMESYNC_TASK_STACK_SIZE
+#define TIMESYNC_TASK_STACK_SIZE 3072
+#endif
+
+// start the sync task (it waits for wifi on its own) and register CLI commands.
+void timesync_init(void);
+
+// shared network time, in usec. before we've synced, it's just our own clock.
+int64_t timesync_now(void);
@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "cli.h"
+#include "pool.h"
+#include "trace.h"
+
+// `duration` is one of these, or else the length of a finished span (usec)
+#define PHASE_BEGIN 0xffffffff
+#define PHASE_END 0xfffffffe
+#define PHASE_INSTANT 0xfffffffd
+
+typedef struct {
+    const char *name;
+    TaskHandle_t task;
+    // usec, low 32 bits of esp_timer_get_time()
+    uint32_t time;
+    uint32_t duration;
+} event_t;
+
+static event_t s_events[TRACE_MAX_EVENTS];
+// events ever recorded; the next one goes at `s_next % TRACE_MAX_EVENTS`
+static uint32_t s_next = 0;
+static bool s_enabled = true;
+// while a dump is being written
+static bool s_paused = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static void record(const char *name, uint32_t time, uint32_t duration) {
+    if (!s_enabled) return;
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&s_lock);
+    if (!s_paused) {
+        event_t *e = &s_events[s_next % TRACE_MAX_EVENTS];
+        e->name = name;
+        e->task = task;
+        e->time = time;
+        e->duration = duration;
+        s_next++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+// ----- API
+
+void trace_begin(const char *name) {
+    record(name, (uint32_t) esp_timer_get_time(), PHASE_BEGIN);
+}
+
+void trace_end(const char *name) {
+    record(name, (uint32_t) esp_timer_get_time(), PHASE_END);
+}
+
+void trace_span(const char *name, int64_t start) {
+    uint32_t duration = (uint32_t) (esp_timer_get_time() - start);
+    // (so it can't be mistaken for a phase)
+    if (duration >= PHASE_INSTANT) duration = PHASE_INSTANT - 1;
+    record(name, (uint32_t) start, duration);
+}
+
+void trace_instant(const char *name) {
+    record(name, (uint32_t) esp_timer_get_time(), PHASE_INSTANT);
+}
+
+void trace_write_json(trace_write_t write, void *context) {
+    portENTER_CRITICAL(&s_lock);
+    s_paused = true;
+    uint32_t next = s_next;
+    portEXIT_CRITICAL(&s_lock);
+
+    int64_t now = esp_timer_get_time();
+    uint32_t count = next < TRACE_MAX_EVENTS ? next : TRACE_MAX_EVENTS;
+    char line[160];
+    write(context, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    // name the tasks that are still around; tids are task handles.
+    bool first = true;
+    TaskStatus_t *tasks = pool_alloc(POOL_BLOCK_SIZE);
+    if (tasks != NULL) {
+        int task_count = uxTaskGetSystemState(tasks, POOL_BLOCK_SIZE / sizeof(TaskStatus_t), NULL);
+        for (int i = 0; i < task_count; i++) {
+            snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", (uint32_t) (uintptr_t) tasks[i].xHandle, tasks[i].pcTaskName);
+            write(context, line);
+            first = false;
+        }
+        pool_free(tasks);
+    }
+
+    for (uint32_t i = next - count; i != next; i++) {
+        const event_t *e = &s_events[i % TRACE_MAX_EVENTS];
+        // widen the timestamp back to 64 bits (it's never more than ~71 minutes old)
+        int64_t ts = now - (uint32_t) ((uint32_t) now - e->time);
+        char *p = line;
+        p += sprintf(p, "%s{\"name\":\"%.48s\",\"pid\":1,\"tid\":%u,\"ts\":%lld,", first ? "" : ",", e->name, (uint32_t) (uintptr_t) e->task, ts);
+        if (e->duration == PHASE_BEGIN) {
+            sprintf(p, "\"ph\":\"B\"}");
+        } else if (e->duration == PHASE_END) {
+            sprintf(p, "\"ph\":\"E\"}");
+        } else if (e->duration == PHASE_INSTANT) {
+            sprintf(p, "\"ph\":\"i\",\"s\":\"t\"}");
+        } else {
+            sprintf(p, "\"ph\":\"X\",\"dur\":%u}", e->duration);
+        }
+        write(context, line);
+        first = false;
+    }
+    write(context, "]}");
+
+    portENTER_CRITICAL(&s_lock);
+    s_paused = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+
+// ----- CLI
+
+static void cmd_trace(const void *command_arg, int argc, const char * const *argv) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "clear") == 0) {
+            portENTER_CRITICAL(&s_lock);
+            s_next = 0;
+            portEXIT_CRITICAL(&s_lock);
+        } else {
+            s_enabled = cli_is_truthy(argv[1]);
+        }
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    uint32_t next = s_next;
+    uint32_t oldest = next == 0 ? 0 : s_events[next < TRACE_MAX_EVENTS ? 0 : next % TRACE_MAX_EVENTS].time;
+    portEXIT_CRITICAL(&s_lock);
+    uint32_t count = next < TRACE_MAX_EVENTS ? next : TRACE_MAX_EVENTS;
+    printf("trace: %s, %u/%d events", s_enabled ? "on" : "off", count, TRACE_MAX_EVENTS);
+    if (count > 0) printf(", covering the last %u ms", ((uint32_t) esp_timer_get_time() - oldest) / 1000);
+    printf(" (GET /trace for the JSON)\n");
+}
+
+static cli_command_t commands[] = {
+    { "trace [on|off|clear]", "show or change the event tracer", cmd_trace, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+void trace_init(void) {
+    cli_register_commands(commands);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * a ring of timestamped events -- begin/end pairs, finished spans, and
+ * one-off markers -- from the render and output tasks, http handlers, wifi
+ * events, and CLI commands. GET /trace dumps it as Chrome trace JSON, so
+ * the last second or so before a glitch can be opened as a timeline in
+ * chrome://tracing or ui.perfetto.dev.
+ *
+ * recording an event is a few dozen cycles, so it's on all the time. event
+ * names must be string literals (or otherwise live forever): only the
+ * pointer is kept.
+ */
+
+// 16 bytes each
+#ifndef TRACE_MAX_EVENTS
+#define TRACE_MAX_EVENTS 1024
+#endif
+
+// receives chunks of text, for `trace_write_json`
+typedef void (*trace_write_t)(void *context, const char *text);
+
+// register CLI commands
+void trace_init(void);
+
+// mark the start and end of something on the calling task. they nest.
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+// record something that already finished, given the `perf_now()` from when it started
+void trace_span(const char *name, int64_t start);
+
+// mark a moment
+void trace_instant(const char *name);
+
+/*
+ * write everything in the ring as a Chrome trace JSON object. recording
+ * pauses while it's written, so the dump is consistent.
+ */
+void trace_write_json(trace_write_t write, void *context);
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "cli.h"
+#include "effect.h"
+#include "render.h"
+#include "vm.h"
+
+#define NVS_KEY "vm-program"
+
+static const struct {
+    uint8_t pops;
+    uint8_t pushes;
+    // bytes of immediate data after the op
+    uint8_t immediate;
+} OPS[VM_OP_COUNT] = {
+    [VM_PUSH8] = { 0, 1, 1 },
+    [VM_PUSH16] = { 0, 1, 2 },
+    [VM_PUSH32] = { 0, 1, 4 },
+    [VM_I] = { 0, 1, 0 },
+    [VM_N] = { 0, 1, 0 },
+    [VM_T] = { 0, 1, 0 },
+    [VM_COLOR] = { 0, 1, 0 },
+    [VM_LOAD] = { 0, 1, 1 },
+    [VM_STORE] = { 1, 0, 1 },
+    [VM_DUP] = { 1, 2, 0 },
+    [VM_DROP] = { 1, 0, 0 },
+    [VM_SWAP] = { 2, 2, 0 },
+    [VM_OVER] = { 2, 3, 0 },
+    [VM_ADD] = { 2, 1, 0 },
+    [VM_SUB] = { 2, 1, 0 },
+    [VM_MUL] = { 2, 1, 0 },
+    [VM_DIV] = { 2, 1, 0 },
+    [VM_MOD] = { 2, 1, 0 },
+    [VM_AND] = { 2, 1, 0 },
+    [VM_OR] = { 2, 1, 0 },
+    [VM_XOR] = { 2, 1, 0 },
+    [VM_SHL] = { 2, 1, 0 },
+    [VM_SHR] = { 2, 1, 0 },
+    [VM_LT] = { 2, 1, 0 },
+    [VM_GT] = { 2, 1, 0 },
+    [VM_EQ] = { 2, 1, 0 },
+    [VM_MIN] = { 2, 1, 0 },
+    [VM_MAX] = { 2, 1, 0 },
+    [VM_NEG] = { 1, 1, 0 },
+    [VM_NOT] = { 1, 1, 0 },
+    [VM_SIN8] = { 1, 1, 0 },
+    [VM_NOISE8] = { 1, 1, 0 },
+    [VM_SCALE8] = { 2, 1, 0 },
+    [VM_HSV] = { 3, 1, 0 },
+    [VM_RGB] = { 3, 1, 0 },
+    [VM_JMP] = { 0, 0, 2 },
+    [VM_JZ] = { 1, 0, 2 },
+    [VM_OUT] = { 1, 0, 0 },
+};
+
+// the same as the native "rainbow" effect, so `vm bench` compares like with like
+static const uint8_t RAINBOW[] = {
+    VM_T, VM_PUSH8, 3, VM_SHR,
+    VM_I, VM_PUSH16, 0x00, 0x01, VM_MUL, VM_N, VM_DIV,
+    VM_ADD, VM_PUSH8, 255, VM_PUSH8, 255, VM_HSV,
+    VM_OUT,
+};
+
+static nvs_handle_t s_nvs_handle;
+static SemaphoreHandle_t s_lock;
+
+// protected by `s_lock`
+static uint8_t s_code[VM_MAX_CODE];
+static bool s_builtin = true;
+
+// render calls that ran out of budget
+static uint32_t s_overruns = 0;
+
+
+static inline uint16_t read16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint8_t hash8(uint32_t n) {
+    n *= 2654435761u;
+    n ^= n >> 15;
+    return n >> 24;
+}
+
+// smooth 1D value noise: `x` is 8.8 fixed point, so the lattice is 256 apart.
+static uint8_t noise8(uint32_t x) {
+    int a = hash8(x >> 8), b = hash8((x >> 8) + 1);
+    uint32_t f = x & 0xff;
+    int ease = (f * f * (768 - 2 * f)) >> 16;
+    return a + (((b - a) * ease) >> 8);
+}
+
+// check every path through the code. returns NULL if it's safe to run, or why not.
+static const char *verify(const uint8_t *code, int size) {
+    // stack depth on entry to each op, or -1 if it hasn't been reached yet
+    int8_t depth[VM_MAX_CODE];
+    uint16_t work[VM_MAX_CODE];
+    int work_count = 0;
+    memset(depth, -1, sizeof(depth));
+    depth[0] = 0;
+    work[work_count++] = 0;
+
+    while (work_count > 0) {
+        int pc = work[--work_count];
+        uint8_t op = code[pc];
+        if (op >= VM_OP_COUNT) return "bad op";
+        if (pc + 1 + OPS[op].immediate > size) return "truncated op";
+        if ((op == VM_LOAD || op == VM_STORE) && code[pc + 1] >= VM_LOCALS) return "bad local";
+        if (depth[pc] < OPS[op].pops) return "stack underflow";
+        int d = depth[pc] - OPS[op].pops + OPS[op].pushes;
+        if (d > VM_STACK_SIZE) return "stack overflow";
+
+        int next[2], next_count = 0;
+        if (op == VM_JMP || op == VM_JZ) next[next_count++] = read16(code + pc + 1);
+        if (op != VM_JMP && op != VM_OUT) next[next_count++] = pc + 1 + OPS[op].immediate;
+        for (int i = 0; i < next_count; i++) {
+            if (next[i] >= size) return "runs off the end";
+            if (depth[next[i]] < 0) {
+                depth[next[i]] = d;
+                work[work_count++] = next[i];
+            } else if (depth[next[i]] != d) {
+                return "stack depth differs between paths";
+            }
+        }
+    }
+    return NULL;
+}
+
+static inline void put_pixel(uint8_t *pixels, int i, uint32_t rgb) {
+    pixels[i * 3] = (rgb >> 16) & 0xff;
+    pixels[i * 3 + 1] = (rgb >> 8) & 0xff;
+    pixels[i * 3 + 2] = rgb & 0xff;
+}
+
+// run verified code for each pixel. returns the number of instructions it took. (`s_lock` must be held.)
+static int run(const uint8_t *code, uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    int32_t locals[VM_LOCALS] = { 0 };
+    int32_t stack[VM_STACK_SIZE];
+    int budget = VM_FRAME_BUDGET;
+
+    for (int i = 0; i < count; i++) {
+        const uint8_t *pc = code;
+        // points at the top value; arithmetic is done unsigned so overflow just wraps
+        int32_t *sp = stack - 1;
+        int32_t a;
+
+        for (;;) {
+            if (--budget < 0) {
+                memset(pixels + i * 3, 0, (count - i) * 3);
+                s_overruns++;
+                return VM_FRAME_BUDGET;
+            }
+            switch (*pc++) {
+                case VM_PUSH8: *++sp = *pc; pc += 1; break;
+                case VM_PUSH16: *++sp = (int16_t) read16(pc); pc += 2; break;
+                case VM_PUSH32: *++sp = (int32_t) (read16(pc) | ((uint32_t) read16(pc + 2) << 16)); pc += 4; break;
+                case VM_I: *++sp = i; break;
+                case VM_N: *++sp = count; break;
+                case VM_T: *++sp = t; break;
+                case VM_COLOR: *++sp = color; break;
+                case VM_LOAD: *++sp = locals[*pc++]; break;
+                case VM_STORE: locals[*pc++] = *sp--; break;
+                case VM_DUP: sp[1] = sp[0]; sp++; break;
+                case VM_DROP: sp--; break;
+                case VM_SWAP: a = sp[0]; sp[0] = sp[-1]; sp[-1] = a; break;
+                case VM_OVER: sp[1] = sp[-1]; sp++; break;
+                case VM_ADD: sp--; sp[0] = (uint32_t) sp[0] + (uint32_t) sp[1]; break;
+                case VM_SUB: sp--; sp[0] = (uint32_t) sp[0] - (uint32_t) sp[1]; break;
+                case VM_MUL: sp--; sp[0] = (uint32_t) sp[0] * (uint32_t) sp[1]; break;
+                case VM_DIV:
+                    sp--;
+                    if (sp[1] == 0) sp[0] = 0;
+                    else if (sp[1] == -1) sp[0] = -(uint32_t) sp[0];
+                    else sp[0] /= sp[1];
+                    break;
+                case VM_MOD:
+                    sp--;
+                    sp[0] = (sp[1] == 0 || sp[1] == -1) ? 0 : sp[0] % sp[1];
+                    break;
+                case VM_AND: sp--; sp[0] &= sp[1]; break;
+                case VM_OR: sp--; sp[0] |= sp[1]; break;
+                case VM_XOR: sp--; sp[0] ^= sp[1]; break;
+                case VM_SHL: sp--; sp[0] = (uint32_t) sp[0] << (sp[1] & 31); break;
+                case VM_SHR: sp--; sp[0] = (uint32_t) sp[0] >> (sp[1] & 31); break;
+                case VM_LT: sp--; sp[0] = sp[0] < sp[1]; break;
+                case VM_GT: sp--; sp[0] = sp[0] > sp[1]; break;
+                case VM_EQ: sp--; sp[0] = sp[0] == sp[1]; break;
+                case VM_MIN: sp--; if (sp[1] < sp[0]) sp[0] = sp[1]; break;
+                case VM_MAX: sp--; if (sp[1] > sp[0]) sp[0] = sp[1]; break;
+                case VM_NEG: sp[0] = -(uint32_t) sp[0]; break;
+                case VM_NOT: sp[0] = !sp[0]; break;
+                case VM_SIN8: sp[0] = effect_sin8(sp[0]); break;
+                case VM_NOISE8: sp[0] = noise8(sp[0]); break;
+                case VM_SCALE8: sp--; sp[0] = effect_scale8(sp[0], sp[1]); break;
+                case VM_HSV: sp -= 2; sp[0] = effect_hsv(sp[0], sp[1], sp[2]); break;
+                case VM_RGB:
+                    sp -= 2;
+                    sp[0] = ((sp[0] & 0xff) << 16) | ((sp[1] & 0xff) << 8) | (sp[2] & 0xff);
+                    break;
+                case VM_JMP: pc = code + read16(pc); break;
+                case VM_JZ: pc = (*sp-- == 0) ? code + read16(pc) : pc + 2; break;
+                case VM_OUT: put_pixel(pixels, i, *sp); goto next_pixel;
+            }
+        }
+    next_pixel:;
+    }
+    return VM_FRAME_BUDGET - budget;
+}
+
+// check a program and start running it. returns NULL on success, or why it was rejected.
+static const char *install(const void *program, size_t size) {
+    const vm_header_t *header = program;
+    if (size < sizeof(vm_header_t) || header->magic != VM_MAGIC || header->version != VM_VERSION) return "not a program";
+    if (header->code_size == 0 || header->code_size > VM_MAX_CODE) return "code is empty or too big";
+    if (header->code_size != size - sizeof(vm_header_t)) return "wrong size";
+    const uint8_t *code = (const uint8_t *) program + sizeof(vm_header_t);
+    const char *error = verify(code, header->code_size);
+    if (error != NULL) return error;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(s_code, code, header->code_size);
+    s_builtin = false;
+    xSemaphoreGive(s_lock);
+    return NULL;
+}
+
+
+// ----- API
+
+void vm_render(uint32_t color, uint32_t t, uint8_t *pixels, int count) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    run(s_code, color, t, pixels, count);
+    xSemaphoreGive(s_lock);
+}
+
+const char *vm_load(const void *program, size_t size) {
+    const char *error = install(program, size);
+    if (error != NULL) return error;
+    nvs_set_blob(s_nvs_handle, NVS_KEY, program, size);
+    nvs_commit(s_nvs_handle);
+    return NULL;
+}
+
+
+// ----- CLI
+
+static void cmd_vm_info(const void *command_arg, int argc, const char * const *argv) {
+    printf("program: %s\n", s_builtin ? "built-in (rainbow)" : "uploaded");
+    printf("budget overruns: %u\n", s_overruns);
+}
+
+static void cmd_vm_reset(const void *command_arg, int argc, const char * const *argv) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(s_code, RAINBOW, sizeof(RAINBOW));
+    s_builtin = true;
+    xSemaphoreGive(s_lock);
+    nvs_erase_key(s_nvs_handle, NVS_KEY);
+    nvs_commit(s_nvs_handle);
+}
+
+#define BENCH_FRAMES 100
+
+// render a full strip with the current program, then with the native rainbow effect
+static void cmd_vm_bench(const void *command_arg, int argc, const char * const *argv) {
+    uint8_t *pixels = malloc(RENDER_MAX_PIXELS * 3);
+    if (pixels == NULL) {
+        printf("out of memory\n");
+        return;
+    }
+
+    int64_t instructions = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_FRAMES; i++) instructions += run(s_code, 0xff8000, i * RENDER_FRAME_MS, pixels, RENDER_MAX_PIXELS);
+    int64_t vm = esp_timer_get_time() - start;
+    xSemaphoreGive(s_lock);
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_FRAMES; i++) effect_render(EFFECT_RAINBOW, 0xff8000, i * RENDER_FRAME_MS, pixels, RENDER_MAX_PIXELS);
+    int64_t native = esp_timer_get_time() - start;
+    free(pixels);
+
+    int pixels_run = BENCH_FRAMES * RENDER_MAX_PIXELS;
+    printf("vm:     %lld ns/pixel, %lld instructions/pixel, %lld us/frame\n",
+        vm * 1000 / pixels_run, instructions / pixels_run, vm / BENCH_FRAMES);
+    printf("native: %lld ns/pixel, %lld us/frame\n", native * 1000 / pixels_run, native / BENCH_FRAMES);
+    printf("(%d pixels; 60 fps leaves 16667 us/frame)\n", RENDER_MAX_PIXELS);
+}
+
+static cli_command_t vm_commands[] = {
+    { "info", "show the effect program", cmd_vm_info, NULL, NULL },
+    { "reset", "go back to the built-in program", cmd_vm_reset, NULL, NULL },
+    { "bench", "time the program against a native effect", cmd_vm_bench, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+static cli_command_t commands[] = {
+    { "vm", NULL, NULL, NULL, vm_commands },
+    CLI_LAST_COMMAND
+};
+
+
+void vm_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    s_lock = xSemaphoreCreateMutex();
+    memcpy(s_code, RAINBOW, sizeof(RAINBOW));
+
+    size_t len = sizeof(vm_header_t) + VM_MAX_CODE;
+    uint8_t *program = malloc(len);
+    if (program != NULL && nvs_get_blob(s_nvs_handle, NVS_KEY, program, &len) == ESP_OK) {
+        const char *error = install(program, len);
+        if (error != NULL) printf("vm_init: saved program rejected: %s\n", error);
+    }
+    free(program);
+    cli_register_commands(commands);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nvs_flash.h"
+
+/*
+ * a tiny stack machine for effects that are uploaded at runtime instead of
+ * compiled in. the program runs once per pixel, and finishes with OUT,
+ * which pops the pixel's color (0xRRGGBB). values are int32; 8-bit helpers
+ * (SIN8, HSV, ...) use the low byte of their inputs.
+ *
+ * a program is a vm_header_t followed by `code_size` bytes of code. it's
+ * checked once when it's loaded -- every op valid, every jump in range, and
+ * the stack depth the same on every path to each op -- so running it only
+ * has to watch the instruction budget. tools/vm_asm.py assembles them.
+ */
+
+#define VM_MAGIC 0x4d564247  // "GBVM"
+#define VM_VERSION 1
+
+// max code bytes in a program
+#ifndef VM_MAX_CODE
+#define VM_MAX_CODE 512
+#endif
+
+#define VM_STACK_SIZE 16
+#define VM_LOCALS 8
+
+/*
+ * max instructions per render call (one segment's frame). a program that
+ * runs out leaves the rest of the segment black.
+ */
+#ifndef VM_FRAME_BUDGET
+#define VM_FRAME_BUDGET 40000
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t code_size;
+} vm_header_t;
+
+typedef enum {
+    // push an immediate: u8, s16, or s32 (little-endian)
+    VM_PUSH8 = 0,
+    VM_PUSH16,
+    VM_PUSH32,
+    // push an input: the pixel index, pixel count, time (msec), or segment color
+    VM_I,
+    VM_N,
+    VM_T,
+    VM_COLOR,
+    // u8 local number. locals start at 0 each frame, and keep their values from pixel to pixel.
+    VM_LOAD,
+    VM_STORE,
+    VM_DUP,
+    VM_DROP,
+    VM_SWAP,
+    VM_OVER,
+    // a b -- (a op b). dividing by 0 gives 0; shifts are unsigned, by the low 5 bits of b; comparisons give 0 or 1.
+    VM_ADD,
+    VM_SUB,
+    VM_MUL,
+    VM_DIV,
+    VM_MOD,
+    VM_AND,
+    VM_OR,
+    VM_XOR,
+    VM_SHL,
+    VM_SHR,
+    VM_LT,
+    VM_GT,
+    VM_EQ,
+    VM_MIN,
+    VM_MAX,
+    VM_NEG,
+    VM_NOT,
+    // builtins: x -- sin8(x), x -- noise8(x) (x is 8.8 fixed point), n scale -- scale8(n, scale),
+    // h s v -- rgb, r g b -- rgb
+    VM_SIN8,
+    VM_NOISE8,
+    VM_SCALE8,
+    VM_HSV,
+    VM_RGB,
+    // u16 absolute code offset; JZ pops and jumps if it's 0
+    VM_JMP,
+    VM_JZ,
+    // rgb -- (and on to the next pixel)
+    VM_OUT,
+    VM_OP_COUNT,
+} vm_op_t;
+
+// load the saved program (or the built-in one), and register CLI commands.
+void vm_init(nvs_handle_t nvs_handle);
+
+// effect callback: run the program for each pixel.
+void vm_render(uint32_t color, uint32_t t, uint8_t *pixels, int count);
+
+/*
+ * check a program (header + code), and if it's good, save it and start
+ * running it. returns NULL on success, or why it was rejected.
+ */
+const char *vm_load(const void *program, size_t size);
@@ -1,11 +1,34 @@
+#include <stdlib.h>
 #include <string.h>
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "esp_wifi.h"
 #include "esp_wifi_default.h"
+#include "esp_system.h"
+#include "cli.h"
+#include "perf.h"
+#include "settings.h"
+#include "trace.h"
 #include "wifi.h"
 
-#define WIFI_MAX_RETRIES 5
+/*
+ * we remember the BSSID & channel of the last AP we connected to, so the
+ * next boot can skip the scan. if that AP fails us, fall back to scanning.
+ * after a disconnect, retry forever, backing off exponentially (with some
+ * jitter, so a fleet doesn't stampede an AP that just rebooted).
+ */
+#define WIFI_BACKOFF_MIN_MS 250
+#define WIFI_BACKOFF_MAX_MS 30000
+
+/*
+ * modem sleep saves power, but adds tens of msec of jitter to incoming
+ * packets. in "auto", we turn it off while we're getting control traffic,
+ * and back on after it's been idle for a while.
+ */
+#define WIFI_PS_CHECK_MS 1000
+
+// the ssid & password are usually changed together, so wait a moment before reconnecting.
+#define WIFI_RECONFIGURE_DELAY_MS 500
 
 enum WifiState {
     OFF = 0,
@@ -14,46 +37,138 @@ enum WifiState {
     ONLINE,
 } s_state = OFF;
 
-static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    static int retries = 0;
+static nvs_handle_t s_nvs_handle;
+static esp_timer_handle_t s_retry_timer;
+static int s_retries = 0;
+// are we pinned to the cached AP?
+static bool s_fast_connect = false;
+static int64_t s_connect_start = 0;
+// set while we disconnect on purpose to switch networks
+static bool s_reconfiguring = false;
+
+static esp_timer_handle_t s_reconfigure_timer;
+
+static wifi_ps_policy_t s_ps_policy = WIFI_PS_POLICY_AUTO;
+static uint32_t s_ps_idle_ms = 0;
+static wifi_ps_type_t s_ps_mode = WIFI_PS_MIN_MODEM;
+static volatile int64_t s_last_activity = 0;
+static esp_timer_handle_t s_ps_timer;
+
+static const char *PS_POLICY_NAMES[] = { "auto", "latency", "power" };
+
+static void retry_callback(void *arg) {
+    s_state = CONNECTING;
+    esp_wifi_connect();
+}
+
+static void schedule_retry(void) {
+    uint32_t delay = WIFI_BACKOFF_MIN_MS << (s_retries < 8 ? s_retries : 8);
+    if (delay > WIFI_BACKOFF_MAX_MS) delay = WIFI_BACKOFF_MAX_MS;
+    delay += esp_random() % (delay / 4 + 1);
+    s_retries++;
+    printf("wifi: retry in %d ms\n", delay);
+    esp_timer_start_once(s_retry_timer, delay * 1000);
+}
+
+static void cache_ap(const uint8_t *bssid, uint8_t channel) {
+    uint8_t old_bssid[6];
+    uint8_t old_channel = 0;
+    size_t len = sizeof(old_bssid);
+    if (
+        nvs_get_blob(s_nvs_handle, "wifi-bssid", old_bssid, &len) == ESP_OK && len == sizeof(old_bssid) &&
+        memcmp(old_bssid, bssid, sizeof(old_bssid)) == 0 &&
+        nvs_get_u8(s_nvs_handle, "wifi-chan", &old_channel) == ESP_OK && old_channel == channel
+    ) return;
+
+    nvs_set_blob(s_nvs_handle, "wifi-bssid", bssid, 6);
+    nvs_set_u8(s_nvs_handle, "wifi-chan", channel);
+    nvs_commit(s_nvs_handle);
+}
+
+// stop aiming at one particular AP, and scan for the SSID instead.
+static void forget_ap(void) {
+    wifi_config_t wifi_config;
+    esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config);
+    wifi_config.sta.bssid_set = false;
+    wifi_config.sta.channel = 0;
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+    s_fast_connect = false;
+}
 
+static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
     if (event_base == WIFI_EVENT) {
         if (event_id == WIFI_EVENT_STA_START) {
             s_state = CONNECTING;
+            s_connect_start = perf_now();
             esp_wifi_connect();
         } else if (event_id == WIFI_EVENT_STA_CONNECTED) {
+            wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *) event_data;
+            trace_instant("wifi connected");
             printf("connected!\n");
             s_state = WAITING_FOR_IP;
-            retries = 0;
+            cache_ap(event->bssid, event->channel);
         } else if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
             printf("disconnected :(\n");
-            if (retries < WIFI_MAX_RETRIES) {
-                retries++;
+            trace_instant("wifi disconnected");
+            bool was_connected = (s_state == ONLINE || s_state == WAITING_FOR_IP);
+            if (was_connected) s_connect_start = perf_now();
+            s_state = CONNECTING;
+            if (s_reconfiguring) {
+                // the new config is already in place.
+                s_reconfiguring = false;
                 esp_wifi_connect();
-            } else {
-                printf("giving up on wifi.\n");
-                s_state = OFF;
+                return;
             }
+            if (s_fast_connect) {
+                // the cached AP went away (or never answered), so scan for the SSID from now on.
+                forget_ap();
+                if (!was_connected) {
+                    printf("wifi: cached AP failed, scanning\n");
+                    esp_wifi_connect();
+                    return;
+                }
+            }
+            schedule_retry();
         }
     } else if (event_base == IP_EVENT) {
         if (event_id == IP_EVENT_STA_GOT_IP) {
             // we have an IP address!
+            trace_instant("wifi got ip");
             s_state = ONLINE;
+            s_retries = 0;
+            perf_timer_record(PERF_TIMER_WIFI_CONNECT, s_connect_start);
+            printf("wifi: online in %lld ms\n", (perf_now() - s_connect_start) / 1000);
         }
     }
 }
 
-static void wifi_login(nvs_handle_t nvs_handle) {
-    char wifi_ssid[64], wifi_pass[64];
-    size_t wifi_ssid_len = sizeof(wifi_ssid), wifi_pass_len = sizeof(wifi_pass);
-    strcpy(wifi_ssid, "none");
-    strcpy(wifi_pass, "none");
-    nvs_get_str(nvs_handle, "wifi-ssid", wifi_ssid, &wifi_ssid_len);
-    nvs_get_str(nvs_handle, "wifi-pass", wifi_pass, &wifi_pass_len);
-    printf("wifi auth: ssid=%s pass=%s\n", wifi_ssid, wifi_pass);
+static void set_ps_mode(wifi_ps_type_t mode) {
+    if (mode == s_ps_mode) return;
+    s_ps_mode = mode;
+    esp_wifi_set_ps(mode);
+}
+
+static void ps_check_callback(void *arg) {
+    if (s_ps_policy != WIFI_PS_POLICY_AUTO || s_ps_mode != WIFI_PS_NONE) return;
+    if (perf_now() - s_last_activity >= (int64_t) s_ps_idle_ms * 1000) set_ps_mode(WIFI_PS_MIN_MODEM);
+}
+
+static void apply_ps_policy(void) {
+    s_ps_mode = (s_ps_policy == WIFI_PS_POLICY_LATENCY) ? WIFI_PS_NONE : WIFI_PS_MIN_MODEM;
+    esp_wifi_set_ps(s_ps_mode);
+}
+
+// load the ssid & password into the driver. it refuses (ESP_ERR_WIFI_STATE) while it's connecting.
+static esp_err_t wifi_login(void) {
+    char wifi_ssid[SETTINGS_STR_SIZE], wifi_pass[SETTINGS_STR_SIZE];
+    settings_get_str(SETTING_WIFI_SSID, wifi_ssid, sizeof(wifi_ssid));
+    settings_get_str(SETTING_WIFI_PASS, wifi_pass, sizeof(wifi_pass));
+    printf("wifi auth: ssid=%s\n", wifi_ssid);
 
     wifi_config_t wifi_config = {
         .sta = {
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
             .threshold.authmode = WIFI_AUTH_WPA2_PSK,
             .pmf_cfg = {
                 .capable = true,
@@ -61,12 +176,95 @@ static void wifi_login(nvs_handle_t nvs_handle) {
             },
         },
     };
-    strcpy((char *)wifi_config.sta.ssid, wifi_ssid);
-    strcpy((char *)wifi_config.sta.password, wifi_pass);
-    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+    // the settings are limited to the sizes these fields can hold (without the 0, for the password).
+    strncpy((char *)wifi_config.sta.ssid, wifi_ssid, sizeof(wifi_config.sta.ssid));
+    strncpy((char *)wifi_config.sta.password, wifi_pass, sizeof(wifi_config.sta.password));
+
+    size_t bssid_len = sizeof(wifi_config.sta.bssid);
+    uint8_t channel = 0;
+    s_fast_connect = (
+        nvs_get_blob(s_nvs_handle, "wifi-bssid", wifi_config.sta.bssid, &bssid_len) == ESP_OK &&
+        bssid_len == sizeof(wifi_config.sta.bssid) &&
+        nvs_get_u8(s_nvs_handle, "wifi-chan", &channel) == ESP_OK
+    );
+    if (s_fast_connect) {
+        printf("wifi: trying cached AP " MACSTR " on channel %d\n", MAC2STR(wifi_config.sta.bssid), channel);
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    }
+    return esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+}
+
+static void reconfigure_callback(void *arg) {
+    wifi_reconfigure();
+}
+
+static void setting_changed(setting_t setting) {
+    if (setting == SETTING_WIFI_SSID || setting == SETTING_WIFI_PASS) {
+        // still booting: `wifi_init` will pick up the new config.
+        if (s_reconfigure_timer == NULL) return;
+        esp_timer_stop(s_reconfigure_timer);
+        esp_timer_start_once(s_reconfigure_timer, WIFI_RECONFIGURE_DELAY_MS * 1000);
+        return;
+    }
+
+    s_ps_policy = settings_get_int(SETTING_WIFI_PS);
+    s_ps_idle_ms = settings_get_int(SETTING_WIFI_PS_IDLE);
+    s_last_activity = perf_now();
+    if (s_ps_timer != NULL) apply_ps_policy();
+}
+
+// ----- CLI
+
+static void cmd_powersave(const void *command_arg, int argc, const char * const *argv) {
+    if (argc > 1) {
+        int policy = -1;
+        for (int i = 0; i <= WIFI_PS_POLICY_POWER; i++) if (strcmp(argv[1], PS_POLICY_NAMES[i]) == 0) policy = i;
+        if (policy < 0) {
+            printf("usage: powersave [auto|latency|power] [idle-ms]\n");
+            return;
+        }
+        if (!wifi_set_ps_policy(policy, argc > 2 ? atoi(argv[2]) : s_ps_idle_ms)) printf("idle-ms is out of range\n");
+    }
+    printf("powersave: %s, idle %d ms, modem sleep %s\n", PS_POLICY_NAMES[s_ps_policy], s_ps_idle_ms,
+        s_ps_mode == WIFI_PS_NONE ? "off" : "on");
 }
 
+static cli_command_t commands[] = {
+    { "powersave [policy] [idle-ms]", "show/set wifi power-save policy", cmd_powersave, NULL, NULL },
+    CLI_LAST_COMMAND
+};
+
+
+// ----- API
+
 void wifi_init(nvs_handle_t nvs_handle) {
+    s_nvs_handle = nvs_handle;
+    esp_timer_create_args_t timer_args = {
+        .callback = retry_callback,
+        .name = "wifi-retry",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &s_retry_timer));
+
+    esp_timer_create_args_t reconfigure_timer_args = {
+        .callback = reconfigure_callback,
+        .name = "wifi-reconfigure",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconfigure_timer_args, &s_reconfigure_timer));
+
+    s_ps_policy = settings_get_int(SETTING_WIFI_PS);
+    s_ps_idle_ms = settings_get_int(SETTING_WIFI_PS_IDLE);
+    settings_watch(SETTING_WIFI_SSID, setting_changed);
+    settings_watch(SETTING_WIFI_PASS, setting_changed);
+    settings_watch(SETTING_WIFI_PS, setting_changed);
+    settings_watch(SETTING_WIFI_PS_IDLE, setting_changed);
+    esp_timer_create_args_t ps_timer_args = {
+        .callback = ps_check_callback,
+        .name = "wifi-ps",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&ps_timer_args, &s_ps_timer));
+
     // first, start up lwip (netif), the event task, and wifi
     ESP_ERROR_CHECK(esp_netif_init());
 
@@ -82,6 +280,57 @@ void wifi_init(nvs_handle_t nvs_handle) {
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, &instance_got_ip));
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    wifi_login(nvs_handle);
+    ESP_ERROR_CHECK(wifi_login());
     ESP_ERROR_CHECK(esp_wifi_start());
+    apply_ps_policy();
+    ESP_ERROR_CHECK(esp_timer_start_periodic(s_ps_timer, WIFI_PS_CHECK_MS * 1000));
+    cli_register_commands(commands);
+}
+
+void wifi_reconfigure(void) {
+    // still booting: `wifi_init` will pick up the new config.
+    if (s_retry_timer == NULL) return;
+
+    esp_timer_stop(s_retry_timer);
+    s_retries = 0;
+    s_connect_start = perf_now();
+
+    // the cached AP is probably for the old network.
+    nvs_erase_key(s_nvs_handle, "wifi-bssid");
+    nvs_erase_key(s_nvs_handle, "wifi-chan");
+    nvs_commit(s_nvs_handle);
+
+    // stop any connect in progress first, or the driver won't take the new config.
+    bool was_connected = (s_state == ONLINE || s_state == WAITING_FOR_IP);
+    esp_wifi_disconnect();
+    esp_err_t err = wifi_login();
+    if (err == ESP_ERR_WIFI_STATE) {
+        // still winding down: try again in a moment.
+        printf("wifi: busy, reconfiguring again shortly\n");
+        esp_timer_start_once(s_reconfigure_timer, WIFI_RECONFIGURE_DELAY_MS * 1000);
+        return;
+    }
+    if (err != ESP_OK) printf("ERROR: wifi: can't set config: %s\n", esp_err_to_name(err));
+
+    if (was_connected) {
+        // reconnect once the disconnect event arrives.
+        s_reconfiguring = true;
+    } else {
+        s_state = CONNECTING;
+        esp_wifi_connect();
+    }
+}
+
+void wifi_activity(void) {
+    s_last_activity = perf_now();
+    if (s_ps_policy == WIFI_PS_POLICY_AUTO && s_ps_mode != WIFI_PS_NONE && s_ps_timer != NULL) set_ps_mode(WIFI_PS_NONE);
+}
+
+bool wifi_set_ps_policy(wifi_ps_policy_t policy, uint32_t idle_ms) {
+    // `setting_changed` applies them.
+    return settings_set_int(SETTING_WIFI_PS_IDLE, idle_ms) && settings_set_int(SETTING_WIFI_PS, policy);
+}
+
+bool wifi_is_online(void) {
+    return s_state == ONLINE;
 }
@@ -1,7 +1,33 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "nvs_flash.h"
 
+typedef enum {
+    // modem sleep only while there's been no control traffic for a while
+    WIFI_PS_POLICY_AUTO = 0,
+    // never sleep
+    WIFI_PS_POLICY_LATENCY,
+    // always sleep
+    WIFI_PS_POLICY_POWER,
+} wifi_ps_policy_t;
+
 void wifi_init(nvs_handle_t nvs_handle);
 
-void wifi_reconfigure(nvs_handle_t nvs_handle);
+/*
+ * reload the ssid & password from settings and reconnect with them, without
+ * touching anything else (the http server and LEDs keep running). this
+ * happens on its own shortly after either setting changes.
+ */
+void wifi_reconfigure(void);
+
+// do we have an IP address?
+bool wifi_is_online(void);
+
+// note that control traffic arrived, so we should be in low-latency mode for a while.
+void wifi_activity(void);
+
+// set (and persist) the power-save policy, and how long to wait before sleeping in "auto".
+// returns false if `idle_ms` is out of range.
+bool wifi_set_ps_policy(wifi_ps_policy_t policy, uint32_t idle_ms);
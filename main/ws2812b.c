@@ -13,12 +13,18 @@
 #include <stdint.h>
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "soc/rtc.h"
 #include "xtensa/hal.h"
 
+#include "perf.h"
+#include "render.h"
+#include "trace.h"
 #include "ws2812b.h"
 
+_Static_assert(FRAMEBUF_SIZE >= RENDER_MAX_PIXELS * 3, "FRAMEBUF_SIZE must hold RENDER_MAX_PIXELS");
+
 #define LONG_PULSE_NS 850
 #define SHORT_PULSE_NS 400
 #define RESET_NS 50000
@@ -30,6 +36,73 @@ rmt_item32_t s_rmt_bit_0;
 rmt_item32_t s_rmt_bit_1;
 rmt_item32_t s_rmt_reset;
 
+static framebuf_t s_frames;
+static TaskHandle_t s_output_task;
+
+// 24 bits per pixel plus the reset. reserved once (about 29KB at 300 pixels) instead of malloc'd every frame.
+static rmt_item32_t s_rmt_items[24 * RENDER_MAX_PIXELS + 1];
+// `ws2812b_show` can be called from outside the output task
+static SemaphoreHandle_t s_rmt_lock;
+
+
+// `pixels` are packed RGB; the strip wants GRB, so swap as we encode.
+static void rmt_transmit(const uint8_t *pixels, int count) {
+    if (count > RENDER_MAX_PIXELS) count = RENDER_MAX_PIXELS;
+    xSemaphoreTake(s_rmt_lock, portMAX_DELAY);
+    int64_t start = perf_now();
+    size_t rmt_count = 24 * count + 1;
+
+    rmt_item32_t *p = s_rmt_items;
+    for (int i = 0; i < count; i++, pixels += 3) {
+        uint32_t grb = (pixels[1] << 16) | (pixels[0] << 8) | pixels[2];
+        for (uint32_t mask = 0x800000; mask != 0; mask >>= 1) {
+            p->val = (((grb & mask) != 0) ? s_rmt_bit_1 : s_rmt_bit_0).val;
+            p++;
+        }
+    }
+    p->val = s_rmt_reset.val;
+    perf_timer_record(PERF_TIMER_ENCODE, start);
+
+    // waits until done
+    start = perf_now();
+    ESP_ERROR_CHECK(rmt_write_items(s_rmt_channel, s_rmt_items, rmt_count, 1));
+    perf_timer_record(PERF_TIMER_TRANSMIT, start);
+    xSemaphoreGive(s_rmt_lock);
+}
+
+static void output_task(void *arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // anything published while we were sending is picked up here, so no frame is stuck waiting.
+        const uint8_t *pixels;
+        int size;
+        while ((pixels = framebuf_take(&s_frames, &size)) != NULL) {
+            if (size > 0) rmt_transmit(pixels, size / 3);
+        }
+    }
+}
+
+void ws2812b_show(const uint8_t *pixels, int count) {
+    if (count <= 0) return;
+    rmt_transmit(pixels, count);
+}
+
+uint8_t *ws2812b_back_buffer(void) {
+    return framebuf_back(&s_frames);
+}
+
+void ws2812b_publish(int count) {
+    uint32_t overwritten = s_frames.overwritten;
+    framebuf_publish(&s_frames, count * 3);
+    // the output task never got to the last frame
+    if (s_frames.overwritten != overwritten) trace_instant("frame overwritten");
+    xTaskNotifyGive(s_output_task);
+}
+
+const framebuf_t *ws2812b_frames(void) {
+    return &s_frames;
+}
+
 
 void ws2812b_init(rmt_channel_t channel, int pin) {
     s_rmt_channel = channel;
@@ -68,41 +141,10 @@ void ws2812b_init(rmt_channel_t channel, int pin) {
     s_rmt_reset.duration1 = 1;
     s_rmt_reset.level1 = 0;
 
-    printf("ws2812b_init: tick=%f, long=%d, short=%d, reset=%d\n", tick_ns, long_cycles, short_cycles, reset_cycles);
-}
+    s_rmt_lock = xSemaphoreCreateMutex();
+    framebuf_init(&s_frames);
+    // above the render task, so a frame goes out as soon as it's published
+    xTaskCreate(output_task, "ws2812b", WS2812B_TASK_STACK_SIZE / sizeof(portSTACK_TYPE), NULL, tskIDLE_PRIORITY + 6, &s_output_task);
 
-static void rmt_transmit(const uint8_t *data, size_t len) {
-    size_t rmt_count = 8 * len + 1;
-    rmt_item32_t *buffer = malloc(rmt_count * sizeof(rmt_item32_t));
-    if (buffer == NULL) {
-        printf("ERROR: failed to malloc rmt\n");
-        return;
-    }
-
-    rmt_item32_t *p = buffer;
-    while (len > 0) {
-        for (uint8_t mask = 0x80; mask != 0; mask >>= 1) {
-            p->val = (((*data & mask) != 0) ? s_rmt_bit_1 : s_rmt_bit_0).val;
-            p++;
-        }
-        data++, len--;
-    }
-    p->val = s_rmt_reset.val;
-
-    // waits until done
-    ESP_ERROR_CHECK(rmt_write_items(s_rmt_channel, buffer, rmt_count, 1));
-    free(buffer);
-}
-
-void ws2812b_set(uint32_t rgb, int count) {
-    printf("ws2812b_set: %06x, count %d\n", rgb, count);
-    uint8_t *message = malloc(3 * count);
-    for (int i = 0; i < count; i++) {
-        // convert to GRB
-        message[i * 3] = (rgb >> 8) & 0xff;
-        message[i * 3 + 1] = (rgb >> 16) & 0xff;
-        message[i * 3 + 2] = rgb & 0xff;
-    }
-    rmt_transmit(message, 3 * count);
-    free(message);
+    printf("ws2812b_init: tick=%f, long=%d, short=%d, reset=%d\n", tick_ns, long_cycles, short_cycles, reset_cycles);
 }
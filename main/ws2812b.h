@@ -1,7 +1,26 @@
 #pragma once
 
 #include "driver/rmt.h"
+#include "framebuf.h"
 
+#ifndef WS2812B_TASK_STACK_SIZE
+#define WS2812B_TASK_STACK_SIZE 2048
+#endif
+
+// set up the RMT channel, and start the output task.
 void ws2812b_init(rmt_channel_t channel, int pin);
 void ws2812b_test(void);
-void ws2812b_set(uint32_t rgb, int count);
+
+// transmit one frame: `count` pixels, packed as RGB (3 bytes each). blocks until sent.
+void ws2812b_show(const uint8_t *pixels, int count);
+
+/*
+ * the output task sends whatever frame was published most recently, so the
+ * task producing frames never waits on the strip. only one task may
+ * publish: fill `ws2812b_back_buffer()` (packed RGB), then publish it.
+ */
+uint8_t *ws2812b_back_buffer(void);
+void ws2812b_publish(int count);
+
+// the output exchange, for its counters
+const framebuf_t *ws2812b_frames(void);
@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+build an animation for the "anim" partition (see main/anim.h), then upload it
+with `make anim FILE=<out> HOST=<name>.local`.
+
+the input is either raw RGB (pixel_count * 3 bytes per frame, back to back)
+or an image, where each row is one frame (needs Pillow).
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4e414247
+VERSION = 1
+KEYFRAME = 0
+DELTA = 1
+HEADER = struct.Struct('<IBBHIHHI')
+
+
+def encode_ops(diff):
+    # runs of unchanged bytes become skips, everything else goes in literally
+    out = bytearray()
+    i = 0
+    while i < len(diff):
+        j = i
+        if diff[i] == 0:
+            while j < len(diff) and j - i < 128 and diff[j] == 0:
+                j += 1
+            out.append(j - i - 1)
+        else:
+            # a short run of zeros inside changed bytes is cheaper to XOR than to skip
+            while j < len(diff) and j - i < 128 and (diff[j] != 0 or any(diff[j:j + 2])):
+                j += 1
+            out.append(0x80 | (j - i - 1))
+            out += diff[i:j]
+        i = j
+    return out
+
+
+def decode_ops(ops, frame):
+    i = p = 0
+    while i < len(frame):
+        op = ops[p]
+        p += 1
+        n = (op & 0x7f) + 1
+        if op & 0x80:
+            for k in range(n):
+                frame[i + k] ^= ops[p + k]
+            p += n
+        i += n
+    assert p == len(ops)
+
+
+def encode(frames, pixel_count, frame_ms, keyframe_interval):
+    size = pixel_count * 3
+    black = bytes(size)
+    index = []
+    body = bytearray()
+    start = HEADER.size + 4 * len(frames)
+    previous = black
+    for n, frame in enumerate(frames):
+        delta = encode_ops(bytes(a ^ b for a, b in zip(frame, previous)))
+        key = encode_ops(frame)
+        # forced keyframes bound the cost of seeking; otherwise pick whichever is smaller
+        if n == 0 or n % keyframe_interval == 0 or len(key) <= len(delta):
+            kind, ops = KEYFRAME, key
+        else:
+            kind, ops = DELTA, delta
+        index.append(start + len(body))
+        body.append(kind)
+        body += ops
+        previous = frame
+
+    total = start + len(body)
+    header = HEADER.pack(MAGIC, VERSION, 0, pixel_count, len(frames), frame_ms, 0, total)
+    return header + struct.pack('<%dI' % len(index), *index) + body
+
+
+def verify(data, frames, pixel_count):
+    size = pixel_count * 3
+    _, _, _, _, count, _, _, total = HEADER.unpack_from(data)
+    index = struct.unpack_from('<%dI' % count, data, HEADER.size)
+    frame = bytearray(size)
+    for n in range(count):
+        end = index[n + 1] if n + 1 < count else total
+        if data[index[n]] == KEYFRAME:
+            frame = bytearray(size)
+        decode_ops(data[index[n] + 1:end], frame)
+        if bytes(frame) != frames[n]:
+            sys.exit('round trip failed at frame %d' % n)
+
+
+def load(path, pixel_count):
+    if path.endswith('.rgb') or path.endswith('.raw'):
+        raw = open(path, 'rb').read()
+        if pixel_count is None:
+            sys.exit('--pixels is needed for raw input')
+        size = pixel_count * 3
+        if len(raw) % size:
+            sys.exit('raw input isn\'t a whole number of frames')
+        return [raw[i:i + size] for i in range(0, len(raw), size)], pixel_count
+
+    from PIL import Image
+    image = Image.open(path).convert('RGB')
+    width, height = image.size
+    if pixel_count is not None and pixel_count != width:
+        image = image.resize((pixel_count, height))
+        width = pixel_count
+    raw = image.tobytes()
+    return [raw[i * width * 3:(i + 1) * width * 3] for i in range(height)], width
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='.rgb/.raw frames, or an image with one frame per row')
+    parser.add_argument('output')
+    parser.add_argument('--pixels', type=int, help='pixels per frame (for images, resizes to this width)')
+    parser.add_argument('--fps', type=float, default=30)
+    parser.add_argument('--keyframe', type=int, default=30, help='force a keyframe every N frames')
+    args = parser.parse_args()
+
+    frames, pixel_count = load(args.input, args.pixels)
+    if not 0 < pixel_count <= 0xffff or not frames:
+        sys.exit('nothing to encode')
+    data = encode(frames, pixel_count, max(1, round(1000 / args.fps)), max(1, args.keyframe))
+    verify(data, frames, pixel_count)
+    open(args.output, 'wb').write(data)
+
+    raw = len(frames) * pixel_count * 3
+    keyframes = sum(1 for n in range(len(frames))
+                    if data[struct.unpack_from('<I', data, HEADER.size + 4 * n)[0]] == KEYFRAME)
+    print('%d frames (%d keyframes) of %d pixels: %d bytes, %.1f%% of %d raw'
+          % (len(frames), keyframes, pixel_count, len(data), 100 * len(data) / raw, raw))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,137 @@
+/*
+ * runs the firmware's audio analyzer (main/analyzer.c) on the host, over a
+ * WAV file or a synthetic beat, and reports how long each block takes
+ * against the time budget for a block at that sample rate.
+ *
+ *     make audio-bench && ./build/audio_bench [file.wav] [-v]
+ *
+ * -v prints the bands and beats as it goes. a host is much faster than an
+ * ESP32, so this is for checking the analysis and relative cost; `audio
+ * bench` on the device gives the real numbers.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "analyzer.h"
+
+#define HOP (ANALYZER_FFT_SIZE / 2)
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+// load 16-bit PCM, mixed down to mono. returns the sample count, or -1.
+static long load_wav(const char *path, int16_t **samples, int *rate) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (data == NULL || fread(data, 1, size, f) != (size_t) size || size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+        fclose(f);
+        free(data);
+        return -1;
+    }
+    fclose(f);
+
+    int channels = 0, bits = 0;
+    for (long p = 12; p + 8 <= size;) {
+        uint32_t len = read_u32(data + p + 4);
+        if (p + 8 + len > (uint32_t) size) break;
+        if (memcmp(data + p, "fmt ", 4) == 0 && len >= 16) {
+            channels = read_u16(data + p + 10);
+            *rate = read_u32(data + p + 12);
+            bits = read_u16(data + p + 22);
+            if (read_u16(data + p + 8) != 1) bits = 0;
+        } else if (memcmp(data + p, "data", 4) == 0 && channels > 0 && bits == 16) {
+            long count = len / 2 / channels;
+            *samples = malloc(count * sizeof(int16_t));
+            const uint8_t *s = data + p + 8;
+            for (long i = 0; i < count; i++) {
+                int32_t mix = 0;
+                for (int c = 0; c < channels; c++) mix += (int16_t) read_u16(s + (i * channels + c) * 2);
+                (*samples)[i] = mix / channels;
+            }
+            free(data);
+            return count;
+        }
+        p += 8 + len + (len & 1);
+    }
+    free(data);
+    return -1;
+}
+
+// 10 seconds of a chord over noise, with a kick drum at 120 bpm
+static long synthesize(int16_t **samples, int rate) {
+    long count = rate * 10L;
+    *samples = malloc(count * sizeof(int16_t));
+    uint32_t noise = 1;
+    for (long i = 0; i < count; i++) {
+        double t = (double) i / rate;
+        double beat = fmod(t, 0.5);
+        double kick = beat < 0.15 ? sin(2 * M_PI * 55 * beat * (1 + (0.15 - beat) * 4)) * exp(-beat * 30) : 0;
+        double chord = (sin(2 * M_PI * 440 * t) + sin(2 * M_PI * 554 * t) + sin(2 * M_PI * 659 * t)) / 3;
+        noise = noise * 1103515245 + 12345;
+        double hiss = ((int) ((noise >> 16) & 0xffff) - 32768) / 32768.0;
+        (*samples)[i] = (int16_t) (20000 * kick + 4000 * chord + 500 * hiss);
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    int verbose = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) verbose = 1; else path = argv[i];
+    }
+
+    int16_t *samples;
+    int rate = 44100;
+    long count = path ? load_wav(path, &samples, &rate) : synthesize(&samples, rate);
+    if (count < ANALYZER_FFT_SIZE) {
+        fprintf(stderr, "%s: not a 16-bit PCM wav, or too short\n", path);
+        return 1;
+    }
+
+    static analyzer_t analyzer;
+    analyzer_init(&analyzer, rate / HOP);
+    long blocks = 0;
+    int64_t total = 0, worst = 0;
+    for (long start = 0; start + ANALYZER_FFT_SIZE <= count; start += HOP, blocks++) {
+        int64_t t = now_ns();
+        analyzer_run(&analyzer, samples + start);
+        int64_t elapsed = now_ns() - t;
+        total += elapsed;
+        if (elapsed > worst) worst = elapsed;
+
+        if (verbose) {
+            printf("%7.3fs ", (double) start / rate);
+            for (int b = 0; b < ANALYZER_BANDS; b++) printf(" %3d", analyzer.result.bands[b]);
+            printf("%s\n", analyzer.result.beat ? "  BEAT" : "");
+        }
+    }
+
+    double seconds = (double) count / rate;
+    double hop_ns = HOP * 1e9 / rate;
+    printf("%s: %.1f s at %d Hz, %ld blocks of %d (hop %d)\n", path ? path : "synthetic", seconds, rate, blocks, ANALYZER_FFT_SIZE, HOP);
+    printf("analysis: %.1f us average, %.1f us worst, per %.0f us block (%.2f%% of the budget)\n",
+        total / 1000.0 / blocks, worst / 1000.0, hop_ns / 1000, 100.0 * total / blocks / hop_ns);
+    printf("beats: %u (%.0f per minute)\n", analyzer.result.beat_count, analyzer.result.beat_count * 60 / seconds);
+    free(samples);
+    return 0;
+}
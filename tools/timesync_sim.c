@@ -0,0 +1,237 @@
+/*
+ * runs a fleet of the firmware's clock sync (main/clocksync.c) on the
+ * host: each instance is a thread with its own UDP socket on 127.0.0.1,
+ * and its own local clock, ahead by up to 20 seconds (as if they booted at
+ * different times) and drifting by up to 50 ppm. announcements go to every
+ * instance's port, standing in for the multicast group. some responses get
+ * held up after they're stamped, like on a busy AP, so the lowest-rtt
+ * filter has something to do.
+ *
+ * after half the run, every instance has to follow the lowest id, and
+ * their network clocks have to agree to within one frame. then the leader
+ * is stopped, and by the end the rest have to agree on the next one.
+ *
+ *     make timesync-sim && ./build/timesync_sim [instances] [seconds]
+ *
+ * exits non-zero if they don't converge.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clocksync.h"
+
+// RENDER_FRAME_MS
+#define FRAME_US 20000
+#define MAX_INSTANCES 16
+#define BASE_PORT 24049
+// every few responses get held this long after they're stamped
+#define DELAY_EVERY 4
+#define DELAY_US 5000
+
+typedef struct {
+    int index;
+    int sock;
+    // local = real * (1 + drift_ppm / 1e6) + skew
+    int64_t skew;
+    int drift_ppm;
+    bool stop;
+
+    // only touched by the instance's thread
+    clocksync_t sync;
+    struct sockaddr_in leader_addr;
+    uint32_t responses_sent;
+
+    // published for the main thread
+    pthread_mutex_t lock;
+    int64_t offset;
+    uint64_t leader_id;
+} instance_t;
+
+static instance_t s_instances[MAX_INSTANCES];
+static int s_count;
+static int64_t s_start;
+
+static int64_t real_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - s_start;
+}
+
+static int64_t local_time(const instance_t *in, int64_t real) {
+    return real + real * in->drift_ppm / 1000000 + in->skew;
+}
+
+static int64_t network_time(instance_t *in, int64_t local) {
+    pthread_mutex_lock(&in->lock);
+    int64_t offset = in->offset;
+    pthread_mutex_unlock(&in->lock);
+    return local + offset;
+}
+
+static struct sockaddr_in address(int index) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BASE_PORT + index),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    return addr;
+}
+
+static void send_packet(instance_t *in, uint8_t type, const struct sockaddr_in *addr, int64_t t1, int64_t t2) {
+    clocksync_packet_t packet = {
+        .magic = CLOCKSYNC_MAGIC,
+        .type = type,
+        .id = in->sync.id,
+        .t1 = t1,
+        .t2 = t2,
+    };
+    if (type != CLOCKSYNC_REQUEST) packet.t3 = network_time(in, local_time(in, real_now()));
+    if (type == CLOCKSYNC_RESPONSE && ++in->responses_sent % DELAY_EVERY == 0) usleep(DELAY_US);
+    sendto(in->sock, &packet, sizeof(packet), 0, (const struct sockaddr *) addr, sizeof(*addr));
+}
+
+// the same loop as timesync_task, with the group swapped for a send to everyone
+static void *instance_task(void *arg) {
+    instance_t *in = arg;
+    int64_t next_announce = 0, next_poll = 0;
+
+    while (!__atomic_load_n(&in->stop, __ATOMIC_RELAXED)) {
+        int64_t now = local_time(in, real_now());
+        if (now >= next_announce) {
+            for (int i = 0; i < s_count; i++) {
+                struct sockaddr_in addr = address(i);
+                if (i != in->index) send_packet(in, CLOCKSYNC_ANNOUNCE, &addr, 0, 0);
+            }
+            next_announce = now + CLOCKSYNC_ANNOUNCE_MS * 1000;
+        }
+        if (clocksync_check_leader(&in->sync, now)) {
+            next_poll = next_announce;
+        } else if (now >= next_poll) {
+            send_packet(in, CLOCKSYNC_REQUEST, &in->leader_addr, now, 0);
+            next_poll = now + (in->sync.sample_count < CLOCKSYNC_SAMPLES ? CLOCKSYNC_FAST_POLL_MS : CLOCKSYNC_POLL_MS) * 1000;
+        }
+
+        // (and wake up now and then to notice `stop`)
+        int64_t wait = (next_poll < next_announce ? next_poll : next_announce) - now;
+        if (wait < 0) wait = 0;
+        if (wait > 100000) wait = 100000;
+        struct timeval tv = { .tv_sec = wait / 1000000, .tv_usec = wait % 1000000 };
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(in->sock, &fds);
+        if (select(in->sock + 1, &fds, NULL, NULL, &tv) <= 0) continue;
+
+        clocksync_packet_t packet;
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(in->sock, &packet, sizeof(packet), 0, (struct sockaddr *) &from, &from_len);
+        int64_t received = local_time(in, real_now());
+        if (len != sizeof(packet) || packet.magic != CLOCKSYNC_MAGIC || packet.id == in->sync.id) continue;
+
+        switch (packet.type) {
+            case CLOCKSYNC_ANNOUNCE:
+                if (clocksync_announce(&in->sync, packet.id, received)) in->leader_addr = from;
+                break;
+            case CLOCKSYNC_REQUEST:
+                send_packet(in, CLOCKSYNC_RESPONSE, &from, packet.t1, network_time(in, received));
+                break;
+            case CLOCKSYNC_RESPONSE: {
+                int64_t offset = clocksync_response(&in->sync, &packet, received);
+                pthread_mutex_lock(&in->lock);
+                in->offset = offset;
+                pthread_mutex_unlock(&in->lock);
+                break;
+            }
+        }
+        pthread_mutex_lock(&in->lock);
+        in->leader_id = clocksync_is_leader(&in->sync, received) ? in->sync.id : in->sync.leader_id;
+        pthread_mutex_unlock(&in->lock);
+    }
+    return NULL;
+}
+
+// do the running instances all follow the lowest id among them, with network clocks within a frame?
+static bool check(const char *when, int skip) {
+    uint64_t lowest = UINT64_MAX;
+    for (int i = 0; i < s_count; i++) if (i != skip && s_instances[i].sync.id < lowest) lowest = s_instances[i].sync.id;
+
+    int64_t real = real_now();
+    int64_t min = INT64_MAX, max = INT64_MIN;
+    bool agreed = true;
+    printf("%s:\n", when);
+    for (int i = 0; i < s_count; i++) {
+        if (i == skip) continue;
+        instance_t *in = &s_instances[i];
+        int64_t t = network_time(in, local_time(in, real));
+        pthread_mutex_lock(&in->lock);
+        uint64_t leader = in->leader_id;
+        pthread_mutex_unlock(&in->lock);
+        printf("  %d: id %012llx, skew %5lld ms, drift %+3d ppm, leader %012llx, network time %lld us\n", i,
+            (unsigned long long) in->sync.id, (long long) in->skew / 1000, in->drift_ppm, (unsigned long long) leader, (long long) t);
+        if (t < min) min = t;
+        if (t > max) max = t;
+        if (leader != lowest) agreed = false;
+    }
+    printf("  spread: %lld us (limit %d)\n", (long long) (max - min), FRAME_US);
+    if (!agreed) printf("FAIL: they don't all follow %012llx\n", (unsigned long long) lowest);
+    if (max - min > FRAME_US) printf("FAIL: network clocks are more than a frame apart\n");
+    return agreed && max - min <= FRAME_US;
+}
+
+int main(int argc, char **argv) {
+    s_count = argc > 1 ? atoi(argv[1]) : 5;
+    int seconds = argc > 2 ? atoi(argv[2]) : 20;
+    if (s_count < 2 || s_count > MAX_INSTANCES) {
+        printf("instances: 2 - %d\n", MAX_INSTANCES);
+        return 1;
+    }
+    srand(time(NULL));
+    s_start = real_now();
+
+    pthread_t threads[MAX_INSTANCES];
+    int leader = 0;
+    for (int i = 0; i < s_count; i++) {
+        instance_t *in = &s_instances[i];
+        in->index = i;
+        in->skew = (int64_t) (rand() % 20000) * 1000;
+        in->drift_ppm = rand() % 101 - 50;
+        pthread_mutex_init(&in->lock, NULL);
+        clocksync_init(&in->sync, ((uint64_t) rand() << 16) ^ rand());
+        if (in->sync.id < s_instances[leader].sync.id) leader = i;
+
+        in->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in addr = address(i);
+        if (in->sock < 0 || bind(in->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            perror("bind");
+            return 1;
+        }
+    }
+    for (int i = 0; i < s_count; i++) pthread_create(&threads[i], NULL, instance_task, &s_instances[i]);
+
+    sleep(seconds / 2);
+    bool ok = check("with everyone", -1);
+
+    printf("stopping the leader (%d)\n", leader);
+    __atomic_store_n(&s_instances[leader].stop, true, __ATOMIC_RELAXED);
+    pthread_join(threads[leader], NULL);
+    sleep(seconds - seconds / 2);
+    ok = check("without the leader", leader) && ok;
+
+    for (int i = 0; i < s_count; i++) {
+        if (i == leader) continue;
+        __atomic_store_n(&s_instances[i].stop, true, __ATOMIC_RELAXED);
+        pthread_join(threads[i], NULL);
+    }
+    if (ok) printf("ok: %d instances converged to within a frame, before and after losing the leader\n", s_count);
+    return ok ? 0 : 1;
+}
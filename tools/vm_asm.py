@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""
+assemble an effect program for the "vm" effect (see main/vm.h), then upload
+it with `make vm FILE=<out> HOST=<name>.local`.
+
+one op per line, lowercase, with `#` comments and `name:` labels:
+
+    # hues from drifting noise: pixels are 1/4 of a noise cell apart (8.8
+    # fixed point), and the pattern moves a cell every second or so
+    i push 6 shl
+    t push 2 shr add
+    noise8
+    push 255 push 255 hsv
+    out
+
+`push N` picks the smallest encoding; `load`/`store` take a local number
+(0-7), and `jmp`/`jz` take a label. `--preview N` runs the program on the
+host for N pixels and prints the colors, which is handy for debugging.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4d564247
+VERSION = 1
+MAX_CODE = 512
+LOCALS = 8
+
+# must match vm_op_t, in order: (name, immediate bytes)
+OPS = [
+    ('push8', 1), ('push16', 2), ('push32', 4),
+    ('i', 0), ('n', 0), ('t', 0), ('color', 0),
+    ('load', 1), ('store', 1),
+    ('dup', 0), ('drop', 0), ('swap', 0), ('over', 0),
+    ('add', 0), ('sub', 0), ('mul', 0), ('div', 0), ('mod', 0),
+    ('and', 0), ('or', 0), ('xor', 0), ('shl', 0), ('shr', 0),
+    ('lt', 0), ('gt', 0), ('eq', 0), ('min', 0), ('max', 0),
+    ('neg', 0), ('not', 0),
+    ('sin8', 0), ('noise8', 0), ('scale8', 0), ('hsv', 0), ('rgb', 0),
+    ('jmp', 2), ('jz', 2),
+    ('out', 0),
+]
+OPCODES = {name: code for code, (name, _) in enumerate(OPS)}
+
+
+class AsmError(Exception):
+    pass
+
+
+def number(text):
+    try:
+        return int(text, 0)
+    except ValueError:
+        raise AsmError('expected a number, got %r' % text)
+
+
+def assemble(source):
+    code = bytearray()
+    labels = {}
+    fixups = []
+    for line_number, line in enumerate(source.splitlines(), 1):
+        words = line.split('#', 1)[0].split()
+        try:
+            while words:
+                word = words.pop(0)
+                if word.endswith(':'):
+                    if word[:-1] in labels:
+                        raise AsmError('duplicate label %r' % word[:-1])
+                    labels[word[:-1]] = len(code)
+                elif word == 'push':
+                    if not words:
+                        raise AsmError('push needs a number')
+                    n = number(words.pop(0))
+                    if 0 <= n <= 0xff:
+                        code += bytes([OPCODES['push8'], n])
+                    elif -0x8000 <= n <= 0x7fff:
+                        code += bytes([OPCODES['push16']]) + struct.pack('<h', n)
+                    elif -0x80000000 <= n <= 0xffffffff:
+                        code += bytes([OPCODES['push32']]) + struct.pack('<I', n & 0xffffffff)
+                    else:
+                        raise AsmError('%d doesn\'t fit in 32 bits' % n)
+                elif word in ('load', 'store'):
+                    n = number(words.pop(0)) if words else -1
+                    if not 0 <= n < LOCALS:
+                        raise AsmError('%s needs a local from 0 to %d' % (word, LOCALS - 1))
+                    code += bytes([OPCODES[word], n])
+                elif word in ('jmp', 'jz'):
+                    if not words:
+                        raise AsmError('%s needs a label' % word)
+                    code.append(OPCODES[word])
+                    fixups.append((len(code), words.pop(0), line_number))
+                    code += b'\0\0'
+                elif word in OPCODES and OPS[OPCODES[word]][1] == 0:
+                    code.append(OPCODES[word])
+                else:
+                    raise AsmError('unknown op %r' % word)
+        except AsmError as e:
+            raise AsmError('line %d: %s' % (line_number, e))
+
+    for offset, label, line_number in fixups:
+        if label not in labels:
+            raise AsmError('line %d: no label %r' % (line_number, label))
+        code[offset:offset + 2] = struct.pack('<H', labels[label])
+    if not code:
+        raise AsmError('empty program')
+    if len(code) > MAX_CODE:
+        raise AsmError('%d bytes of code (max %d)' % (len(code), MAX_CODE))
+    return bytes(code)
+
+
+# ----- host-side interpreter, matching vm.c
+
+SIN_QUARTER = [
+    0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46, 49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83,
+    85, 88, 90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116, 117, 118, 120, 121, 122, 122,
+    123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127,
+]
+
+
+def sin8(theta):
+    theta &= 0xff
+    q = theta & 63
+    return [128 + SIN_QUARTER[q], 128 + SIN_QUARTER[64 - q], 128 - SIN_QUARTER[q], 128 - SIN_QUARTER[64 - q]][theta >> 6]
+
+
+def hash8(n):
+    n = (n * 2654435761) & 0xffffffff
+    n ^= n >> 15
+    return n >> 24
+
+
+def noise8(x):
+    x &= 0xffffffff
+    a, b = hash8(x >> 8), hash8((x >> 8) + 1)
+    f = x & 0xff
+    ease = (f * f * (768 - 2 * f)) >> 16
+    return (a + (((b - a) * ease) >> 8)) & 0xff
+
+
+def hsv(h, s, v):
+    h, s, v = h & 0xff, s & 0xff, v & 0xff
+    region = h // 43
+    remainder = ((h - region * 43) * 6) & 0xff
+    p = (v * (255 - s)) >> 8
+    q = (v * (255 - ((s * remainder) >> 8))) >> 8
+    t = (v * (255 - ((s * (255 - remainder)) >> 8))) >> 8
+    r, g, b = [(v, t, p), (q, v, p), (p, v, t), (p, q, v), (t, p, v), (v, p, q)][min(region, 5)]
+    return (r << 16) | (g << 8) | b
+
+
+def s32(n):
+    n &= 0xffffffff
+    return n - (1 << 32) if n & 0x80000000 else n
+
+
+def c_div(a, b):
+    # C division truncates toward 0
+    q = abs(a) // abs(b)
+    return q if (a < 0) == (b < 0) else -q
+
+
+BINARY = {
+    'add': lambda a, b: a + b,
+    'sub': lambda a, b: a - b,
+    'mul': lambda a, b: a * b,
+    'div': lambda a, b: 0 if b == 0 else c_div(a, b),
+    'mod': lambda a, b: 0 if b in (0, -1) else a - b * c_div(a, b),
+    'and': lambda a, b: a & b,
+    'or': lambda a, b: a | b,
+    'xor': lambda a, b: a ^ b,
+    'shl': lambda a, b: a << (b & 31),
+    'shr': lambda a, b: (a & 0xffffffff) >> (b & 31),
+    'lt': lambda a, b: int(a < b),
+    'gt': lambda a, b: int(a > b),
+    'eq': lambda a, b: int(a == b),
+    'min': min,
+    'max': max,
+    'scale8': lambda a, b: ((a & 0xff) * (1 + (b & 0xff))) >> 8,
+}
+
+UNARY = {
+    'neg': lambda a: -a,
+    'not': lambda a: int(a == 0),
+    'sin8': sin8,
+    'noise8': noise8,
+}
+
+
+def run(code, count, t, color):
+    pixels = []
+    steps = 0
+    local = [0] * LOCALS
+    for i in range(count):
+        pc, stack = 0, []
+        while True:
+            name, imm = OPS[code[pc]]
+            arg = code[pc + 1:pc + 1 + imm]
+            pc += 1 + imm
+            steps += 1
+            if name == 'push8': stack.append(arg[0])
+            elif name == 'push16': stack.append(struct.unpack('<h', arg)[0])
+            elif name == 'push32': stack.append(struct.unpack('<i', arg)[0])
+            elif name == 'i': stack.append(i)
+            elif name == 'n': stack.append(count)
+            elif name == 't': stack.append(s32(t))
+            elif name == 'color': stack.append(s32(color))
+            elif name == 'load': stack.append(local[arg[0]])
+            elif name == 'store': local[arg[0]] = stack.pop()
+            elif name == 'dup': stack.append(stack[-1])
+            elif name == 'drop': stack.pop()
+            elif name == 'swap': stack[-1], stack[-2] = stack[-2], stack[-1]
+            elif name == 'over': stack.append(stack[-2])
+            elif name in UNARY: stack.append(s32(UNARY[name](stack.pop())))
+            elif name in BINARY:
+                b = stack.pop()
+                stack.append(s32(BINARY[name](stack.pop(), b)))
+            elif name in ('hsv', 'rgb'):
+                c, b, a = stack.pop(), stack.pop(), stack.pop()
+                stack.append(hsv(a, b, c) if name == 'hsv' else ((a & 0xff) << 16) | ((b & 0xff) << 8) | (c & 0xff))
+            elif name == 'jmp': pc = struct.unpack('<H', arg)[0]
+            elif name == 'jz':
+                if stack.pop() == 0:
+                    pc = struct.unpack('<H', arg)[0]
+            elif name == 'out':
+                pixels.append(stack.pop() & 0xffffff)
+                break
+    return pixels, steps
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='assembly source')
+    parser.add_argument('output', nargs='?', help='program to upload')
+    parser.add_argument('--preview', type=int, metavar='N', help='run on the host for N pixels and print the colors')
+    parser.add_argument('--t', type=int, default=0, help='time (msec) for --preview')
+    parser.add_argument('--color', type=lambda s: int(s, 16), default=0xff8000, help='segment color (RRGGBB) for --preview')
+    args = parser.parse_args()
+
+    try:
+        code = assemble(open(args.input).read())
+    except AsmError as e:
+        sys.exit('%s: %s' % (args.input, e))
+    if args.output:
+        with open(args.output, 'wb') as f:
+            f.write(struct.pack('<IBBH', MAGIC, VERSION, 0, len(code)) + code)
+    print('%d bytes of code' % len(code))
+
+    if args.preview:
+        pixels, steps = run(code, args.preview, args.t, args.color)
+        print(' '.join('%06x' % p for p in pixels))
+        print('%.1f instructions/pixel' % (steps / args.preview))
+
+
+if __name__ == '__main__':
+    main()